@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <fantom/math.hpp>
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "SymmetricEigen.hpp"
+
+using namespace fantom;
+using namespace plugin1;
+
+// Accuracy and speed of the closed form symmetric eigensolver against
+// Eigen::SelfAdjointEigenSolver. The matrices are built from random rotations
+// and eigenvalues, a part of them with two or three (nearly) equal
+// eigenvalues. Errors are relative to the largest eigenvalue magnitude:
+// eigenvalues against the construction, eigenvectors as residual |Av - lv|
+// and as deviation from orthonormality. Writes JSON to stdout and exits with
+// 1 if an error exceeds its bound.
+//
+//   eigen_benchmark [count]
+
+namespace
+{
+	Eigen::Matrix3d to_eigen(const SymmetricMatrix3& m) {
+		Eigen::Matrix3d a;
+		a << m.xx, m.xy, m.xz,
+		     m.xy, m.yy, m.yz,
+		     m.xz, m.yz, m.zz;
+		return a;
+	}
+
+	// random rotation times diag(values) times its transpose
+	SymmetricMatrix3 make_matrix(std::mt19937& generator, const double values[3]) {
+		std::normal_distribution<double> normal;
+		Eigen::Quaterniond rotation(normal(generator), normal(generator), normal(generator), normal(generator));
+		Eigen::Matrix3d r = rotation.normalized().toRotationMatrix();
+		Eigen::Matrix3d a = r * Eigen::Vector3d(values[0], values[1], values[2]).asDiagonal() * r.transpose();
+		return SymmetricMatrix3{ a(0, 0), a(0, 1), a(0, 2), a(1, 1), a(1, 2), a(2, 2) };
+	}
+
+	struct Errors {
+		double value = 0;
+		double residual = 0;
+		double orthogonality = 0;
+
+		void add(const SymmetricMatrix3& m, const double expected[3], const SymmetricEigen& e) {
+			double scale = std::max({ std::abs(expected[0]), std::abs(expected[1]), std::abs(expected[2]), 1e-300 });
+			Eigen::Matrix3d a = to_eigen(m);
+			for (size_t i = 0; i < 3; i++) {
+				value = std::max(value, std::abs(e.values[i] - expected[i]) / scale);
+				Eigen::Vector3d v(e.vectors[i][0], e.vectors[i][1], e.vectors[i][2]);
+				residual = std::max(residual, (a * v - e.values[i] * v).norm() / scale);
+				for (size_t j = 0; j < 3; j++) {
+					double d = e.vectors[i][0] * e.vectors[j][0] + e.vectors[i][1] * e.vectors[j][1] + e.vectors[i][2] * e.vectors[j][2];
+					orthogonality = std::max(orthogonality, std::abs(d - (i == j ? 1.0 : 0.0)));
+				}
+			}
+		}
+	};
+
+	template<class F>
+	double seconds(F f) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	if (count == 0) {
+		std::fprintf(stderr, "usage: %s [count]\n", argv[0]);
+		return 1;
+	}
+
+	// every fourth matrix has a repeated eigenvalue, every 16th is nearly
+	// isotropic, a few are exactly isotropic or zero
+	std::mt19937 generator(7);
+	std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+	std::vector<SymmetricMatrix3> matrices(count);
+	std::vector<double> expected(3 * count);
+	for (size_t i = 0; i < count; i++) {
+		double* values = &expected[3 * i];
+		double magnitude = std::pow(10.0, 6 * uniform(generator));
+		for (size_t k = 0; k < 3; k++)
+			values[k] = magnitude * uniform(generator);
+		if (i % 4 == 1) values[2] = values[1];
+		if (i % 16 == 3) values[1] = values[0] * (1 + 1e-9), values[2] = values[0] * (1 - 1e-9);
+		if (i % 1000 == 5) values[1] = values[2] = values[0];
+		if (i % 1000 == 7) values[0] = values[1] = values[2] = 0;
+		std::sort(values, values + 3);
+		matrices[i] = make_matrix(generator, values);
+	}
+
+	std::vector<SymmetricEigen> closed(count), batch(count);
+	std::vector<SymmetricEigen> reference(count);
+	double eigen_time = seconds([&]() {
+		for (size_t i = 0; i < count; i++) {
+			Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(to_eigen(matrices[i]));
+			for (size_t k = 0; k < 3; k++) {
+				reference[i].values[k]  = solver.eigenvalues()[k];
+				reference[i].vectors[k] = Vector3(solver.eigenvectors()(0, k), solver.eigenvectors()(1, k), solver.eigenvectors()(2, k));
+			}
+		}
+	});
+	double closed_time = seconds([&]() {
+		for (size_t i = 0; i < count; i++)
+			closed[i] = symmetric_eigen(matrices[i]);
+	});
+	double batch_time = seconds([&]() {
+		symmetric_eigen_batch(matrices.data(), count, batch.data());
+	});
+
+	Errors eigen_errors, closed_errors, batch_errors;
+	double batch_difference = 0;
+	for (size_t i = 0; i < count; i++) {
+		eigen_errors.add(matrices[i], &expected[3 * i], reference[i]);
+		closed_errors.add(matrices[i], &expected[3 * i], closed[i]);
+		batch_errors.add(matrices[i], &expected[3 * i], batch[i]);
+		for (size_t k = 0; k < 3; k++)
+			batch_difference = std::max(batch_difference, std::abs(batch[i].values[k] - closed[i].values[k]));
+	}
+
+	// bounds for the closed form solver, a few hundred ulp of the scale
+	const double value_bound = 1e-12, residual_bound = 1e-12, orthogonality_bound = 1e-12;
+	bool passed = true;
+	for (auto* errors : { &closed_errors, &batch_errors })
+		passed = passed && errors->value < value_bound && errors->residual < residual_bound && errors->orthogonality < orthogonality_bound;
+
+	auto print = [&](const char* name, double time, const Errors& errors, bool last) {
+		std::printf("    {\"solver\": \"%s\", \"seconds\": %.6f, \"matrices_per_second\": %.1f, "
+		            "\"max_value_error\": %.3e, \"max_residual\": %.3e, \"max_orthogonality_error\": %.3e}%s\n",
+		            name, time, count / time, errors.value, errors.residual, errors.orthogonality, last ? "" : ",");
+	};
+	std::printf("{\n  \"matrices\": %zu,\n  \"solvers\": [\n", count);
+	print("eigen", eigen_time, eigen_errors, false);
+	print("closed_form", closed_time, closed_errors, false);
+	print("closed_form_batch", batch_time, batch_errors, true);
+	std::printf("  ],\n  \"batch_max_difference\": %.3e,\n  \"passed\": %s\n}\n", batch_difference, passed ? "true" : "false");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fantom/math.hpp>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FieldSampler.hpp"
+#include "PacketIntegrator.hpp"
+#include "StreamlineBuffer.hpp"
+#include "StreamlineIntegration.hpp"
+
+using namespace fantom;
+using namespace plugin1;
+
+// Integrator benchmark suite. Every integrator runs on analytic fields that
+// are sampled on uniform grids of increasing size. Per run it reports the
+// throughput, the sampler calls per step, the memory of grid and lines and
+// the distance of the lines to the streamlines of the analytic field.
+// Results go to stdout as JSON, progress to stderr.
+//
+//   integrator_benchmark [--seeds N] [--steps N] [--sizes 32,64,128] [--error-seeds N]
+
+namespace
+{
+	const double pi = std::acos(-1.0);
+
+	struct AnalyticField {
+		std::string name;
+		Point3 low, high;
+		double step;
+		std::function<Vector3(const Point3&)> velocity;
+	};
+
+	// ABC flow with A = sqrt(3), B = sqrt(2), C = 1 on [0, 2pi]^3
+	Vector3 abc_flow(const Point3& p) {
+		const double a = std::sqrt(3.0), b = std::sqrt(2.0), c = 1.0;
+		return Vector3(a * std::sin(p[2]) + c * std::cos(p[1]),
+		               b * std::sin(p[0]) + a * std::cos(p[2]),
+		               c * std::sin(p[1]) + b * std::cos(p[0]));
+	}
+
+	// steady double gyre (A = 0.1, no oscillation) on [0, 2] x [0, 1], extruded along z
+	Vector3 double_gyre(const Point3& p) {
+		const double a = 0.1;
+		return Vector3(-pi * a * std::sin(pi * p[0]) * std::cos(pi * p[1]),
+		                pi * a * std::cos(pi * p[0]) * std::sin(pi * p[1]),
+		                0.0);
+	}
+
+	// Hill's spherical vortex of radius 1 moving with U = 1 along z, seen from
+	// the vortex. inside a vortex ring, outside the potential flow around it
+	Vector3 hill_vortex(const Point3& p) {
+		const double u = 1.0;
+		double rho2 = p[0] * p[0] + p[1] * p[1];
+		double r2   = rho2 + p[2] * p[2];
+		double radial, axial;
+		if (r2 < 1.0) {
+			radial = 1.5 * u * p[2];
+			axial  = 1.5 * u * (1.0 - 2.0 * rho2 - p[2] * p[2]);
+		} else {
+			double r5 = r2 * r2 * std::sqrt(r2);
+			radial = 1.5 * u * p[2] / r5;
+			axial  = -u * (1.0 - 1.0 / (r2 * std::sqrt(r2))) - 1.5 * u * rho2 / r5;
+		}
+		// radial is the radial velocity divided by rho
+		return Vector3(radial * p[0], radial * p[1], axial);
+	}
+
+	UniformGridSampler<3, Vector3> sample_field(const AnalyticField& field, size_t n) {
+		size_t extent[3];
+		double origin[3], spacing[3];
+		for (size_t d = 0; d < 3; d++) {
+			extent[d]  = n;
+			origin[d]  = field.low[d];
+			spacing[d] = (field.high[d] - field.low[d]) / (n - 1);
+		}
+		std::vector<Vector3> values(n * n * n);
+		for (size_t k = 0; k < n; k++)
+			for (size_t j = 0; j < n; j++)
+				for (size_t i = 0; i < n; i++)
+					values[(k * n + j) * n + i] = field.velocity(Point3(origin[0] + i * spacing[0], origin[1] + j * spacing[1], origin[2] + k * spacing[2]));
+		return UniformGridSampler<3, Vector3>(extent, origin, spacing, values);
+	}
+
+	// counts how often the integrators ask for a value
+	struct CountingSampler {
+		const UniformGridSampler<3, Vector3>& grid;
+		size_t calls;
+
+		bool sample(const Point3& point, Vector3& value) {
+			calls++;
+			return grid.sample(point, value);
+		}
+	};
+
+	// the analytic field restricted to the box, as reference for the error
+	struct AnalyticSampler {
+		const AnalyticField& field;
+
+		bool sample(const Point3& point, Vector3& value) {
+			for (size_t d = 0; d < 3; d++)
+				if (point[d] < field.low[d] || point[d] > field.high[d]) return false;
+			value = field.velocity(point);
+			return true;
+		}
+	};
+
+	double segment_distance(const Point3& p, const Point3& a, const Point3& b) {
+		Vector3 ab = b - a;
+		Vector3 ap = p - a;
+		double length2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+		double t = length2 > 0 ? std::min(std::max((ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / length2, 0.0), 1.0) : 0.0;
+		return norm(p - (a + t * ab));
+	}
+
+	// distance of every vertex of `line` to a reference streamline from the
+	// same seed, integrated on the analytic field with a ten times smaller
+	// step. the search walks along the reference, both lines run in the same
+	// direction
+	void line_error(const AnalyticField& field, const StreamlineBuffer& lines, size_t l, double& max_error, double& sum_error, size_t& count) {
+		size_t begin = lines.line_begin(l), end = lines.line_end(l);
+		if (end - begin < 2) return;
+		double length = 0;
+		for (size_t i = begin + 1; i < end; i++)
+			length += norm(lines.vertices[i] - lines.vertices[i - 1]);
+
+		AnalyticSampler analytic{field};
+		StreamlineBuffer reference;
+		TerminationRules rules;
+		rules.max_length = 1.2 * length + field.step;
+		runge_kutta_line(analytic, reference, lines.vertices[begin], 100000, field.step / 10, rules);
+		if (reference.num_points() < 2) return;
+
+		// arc length along the reference
+		std::vector<double> arc(reference.num_points(), 0.0);
+		for (size_t k = 1; k < arc.size(); k++)
+			arc[k] = arc[k - 1] + norm(reference.vertices[k] - reference.vertices[k - 1]);
+
+		// the search window covers twice the length of the last step
+		size_t j = 0;
+		for (size_t i = begin; i < end; i++) {
+			const Point3& p = lines.vertices[i];
+			double reach = (i > begin ? 2 * norm(p - lines.vertices[i - 1]) : 0.0) + field.step;
+			size_t best = j;
+			double best_distance = segment_distance(p, reference.vertices[j], reference.vertices[j + 1]);
+			for (size_t k = j + 1; k + 1 < reference.num_points() && arc[k] - arc[j] <= reach; k++) {
+				double distance = segment_distance(p, reference.vertices[k], reference.vertices[k + 1]);
+				if (distance < best_distance) {
+					best_distance = distance;
+					best = k;
+				}
+			}
+			j = best;
+			max_error  = std::max(max_error, best_distance);
+			sum_error += best_distance;
+			count++;
+		}
+	}
+
+	std::string number(double value) {
+		char text[32];
+		std::snprintf(text, sizeof(text), "%.6g", value);
+		return text;
+	}
+
+	template<class F>
+	double seconds(F f) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	struct Settings {
+		size_t seeds       = 10000;
+		size_t steps       = 200;
+		size_t error_seeds = 200;
+		std::vector<size_t> sizes { 32, 64, 128 };
+	};
+
+	bool parse(int argc, char** argv, Settings& settings) {
+		for (int i = 1; i + 1 < argc; i += 2) {
+			if (!std::strcmp(argv[i], "--seeds")) {
+				settings.seeds = std::strtoul(argv[i + 1], nullptr, 10);
+			} else if (!std::strcmp(argv[i], "--steps")) {
+				settings.steps = std::strtoul(argv[i + 1], nullptr, 10);
+			} else if (!std::strcmp(argv[i], "--error-seeds")) {
+				settings.error_seeds = std::strtoul(argv[i + 1], nullptr, 10);
+			} else if (!std::strcmp(argv[i], "--sizes")) {
+				settings.sizes.clear();
+				for (char* s = argv[i + 1]; *s;) {
+					settings.sizes.push_back(std::strtoul(s, &s, 10));
+					if (*s == ',') s++;
+				}
+			} else {
+				return false;
+			}
+		}
+		if (argc % 2 == 0) return false;
+		for (size_t n : settings.sizes)
+			if (n < 2) return false;
+		return settings.seeds > 0;
+	}
+}
+
+int main(int argc, char** argv) {
+	Settings settings;
+	if (!parse(argc, argv, settings)) {
+		std::fprintf(stderr, "usage: %s [--seeds N] [--steps N] [--sizes 32,64,128] [--error-seeds N]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<AnalyticField> fields {
+		{ "abc", Point3(0, 0, 0), Point3(2 * pi, 2 * pi, 2 * pi), 0.01, abc_flow },
+		{ "double_gyre", Point3(0, 0, 0), Point3(2, 1, 1), 0.05, double_gyre },
+		{ "hill_vortex", Point3(-1.5, -1.5, -1.5), Point3(1.5, 1.5, 1.5), 0.01, hill_vortex },
+	};
+	enum Method { EULER, RUNGE_KUTTA, DORMAND_PRINCE, EULER_PACKETS, RUNGE_KUTTA_PACKETS, METHOD_NUM };
+	const char* method_names[] = { "euler", "runge_kutta", "dormand_prince", "euler_packets", "runge_kutta_packets" };
+
+	std::printf("{\n  \"seeds\": %zu,\n  \"steps\": %zu,\n  \"runs\": [", settings.seeds, settings.steps);
+	bool first_run = true;
+
+	for (auto& field : fields) {
+		// seeds inside the inner 80% of the box
+		std::mt19937 generator(42);
+		std::vector<Point3> seeds(settings.seeds);
+		for (auto& seed : seeds) {
+			for (size_t d = 0; d < 3; d++) {
+				double margin = 0.1 * (field.high[d] - field.low[d]);
+				seed[d] = std::uniform_real_distribution<double>(field.low[d] + margin, field.high[d] - margin)(generator);
+			}
+		}
+
+		for (size_t n : settings.sizes) {
+			auto grid = sample_field(field, n);
+			PacketIntegrator packets(grid);
+			size_t grid_bytes = grid.values.size() * sizeof(Vector3);
+
+			DormandPrinceParams params;
+			params.tolerance = 1e-6;
+			params.min_step  = field.step / 100;
+			params.max_step  = field.step * 10;
+
+			StreamlineBuffer scalar_lines[2];
+			for (size_t m = 0; m < METHOD_NUM; m++) {
+				std::fprintf(stderr, "%s %zu^3 %s\n", field.name.c_str(), n, method_names[m]);
+				StreamlineBuffer lines;
+				CountingSampler sampler{grid, 0};
+				std::vector<Termination> reasons(seeds.size());
+				double time = seconds([&]() {
+					for (size_t i = 0; i < seeds.size(); i++) {
+						if (m == EULER)
+							euler_line(sampler, lines, seeds[i], settings.steps, field.step);
+						else if (m == RUNGE_KUTTA)
+							runge_kutta_line(sampler, lines, seeds[i], settings.steps, field.step);
+						else if (m == DORMAND_PRINCE)
+							dormand_prince_line(sampler, lines, seeds[i], settings.steps, field.step, params);
+					}
+					if (m == EULER_PACKETS || m == RUNGE_KUTTA_PACKETS) {
+						auto method = m == EULER_PACKETS ? PacketIntegrator::EULER : PacketIntegrator::RUNGE_KUTTA;
+						packets.integrate(method, seeds.data(), seeds.size(), settings.steps, field.step, lines, reasons.data());
+					}
+				});
+
+				size_t steps = lines.num_points() - lines.num_lines();
+				double max_error = 0, sum_error = 0;
+				size_t error_count = 0;
+				for (size_t l = 0; l < std::min(settings.error_seeds, lines.num_lines()); l++)
+					line_error(field, lines, l, max_error, sum_error, error_count);
+
+				// packets are expected to match the scalar kernels exactly, null
+				// if the lines do not even have the same vertex counts
+				std::string difference = "null";
+				bool packet = m == EULER_PACKETS || m == RUNGE_KUTTA_PACKETS;
+				if (packet) {
+					auto& scalar = scalar_lines[m == EULER_PACKETS ? 0 : 1];
+					if (scalar.offsets == lines.offsets) {
+						double max_difference = 0;
+						for (size_t i = 0; i < lines.num_points(); i++)
+							max_difference = std::max(max_difference, norm(scalar.vertices[i] - lines.vertices[i]));
+						difference = number(max_difference);
+					}
+				}
+
+				std::printf("%s\n    {\"field\": \"%s\", \"grid\": %zu, \"method\": \"%s\", \"simd\": %s, \"seconds\": %.6f, \"steps\": %zu, "
+				            "\"steps_per_second\": %.1f, \"evaluations_per_step\": %s, \"grid_bytes\": %zu, \"line_bytes\": %zu, "
+				            "\"max_error\": %.3e, \"mean_error\": %.3e, \"max_difference_to_scalar\": %s}",
+				            first_run ? "" : ",", field.name.c_str(), n, method_names[m],
+				            packet && packets.vectorized() ? "true" : "false", time, steps, steps / time,
+				            packet ? "null" : number(steps ? double(sampler.calls) / steps : 0.0).c_str(),
+				            grid_bytes + (packet && packets.vectorized() ? grid_bytes : 0),
+				            lines.vertices.capacity() * sizeof(Point3) + lines.offsets.capacity() * sizeof(size_t),
+				            max_error, error_count ? sum_error / error_count : 0.0,
+				            difference.c_str());
+				first_run = false;
+
+				if (m == EULER) scalar_lines[0] = std::move(lines);
+				if (m == RUNGE_KUTTA) scalar_lines[1] = std::move(lines);
+			}
+		}
+	}
+	std::printf("\n  ]\n}\n");
+	return 0;
+}
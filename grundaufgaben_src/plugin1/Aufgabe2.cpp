@@ -17,6 +17,8 @@
 #include <memory>
 #include <vector>
 
+#include "ChunkedExecution.hpp"
+
 using namespace fantom;
 using namespace std;
 
@@ -62,7 +64,7 @@ namespace
 			{
 			}
 
-			virtual void execute( const Algorithm::Options& options, const volatile bool& /*abortFlag*/ ) override
+			virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override
 			{
 				auto surface_mode = options.get<bool>("Surface Mode");
 				auto color = options.get<Color>("Color");
@@ -94,15 +96,20 @@ namespace
 						}
 					}
 				} else {
-					for(size_t i = 0; i < grid->numCells(); i++){
-						Cell cell = grid->cell(i);
-						// split cell into faces, is either quad or triangle
-						for(size_t f = 0; f < cell.numFaces(); f++){
-							Cell face = cell.face(f);
-							add_indices(indices, face, surface_mode);
+					// walk the cells in chunks so large grids can be aborted
+					plugin1::Progress progress("collecting cell faces", grid->numCells());
+					bool finished = plugin1::for_each_chunk(grid->numCells(), 4096, abortFlag, progress, [&](size_t begin, size_t end) {
+						for(size_t i = begin; i < end; i++){
+							Cell cell = grid->cell(i);
+							// split cell into faces, is either quad or triangle
+							for(size_t f = 0; f < cell.numFaces(); f++){
+								Cell face = cell.face(f);
+								add_indices(indices, face, surface_mode);
+							}
 						}
-					}
-
+					});
+					if(!finished)
+						return;
 				}
 
 
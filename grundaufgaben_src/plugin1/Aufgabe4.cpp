@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
 #include <cstdio>
@@ -8,10 +9,28 @@
 #include <fantom/dataset.hpp>
 #include <fantom/datastructures/domains/Grid.hpp>
 #include <fantom/datastructures/interfaces/Field.hpp>
+#include <iostream>
 #include <memory>
+#include <typeinfo>
+#include <utility>
 #include <vector>
 
+#include "ChunkedExecution.hpp"
+#include "EvenlySpacedSeeding.hpp"
+#include "FieldSampler.hpp"
+#include "PacketIntegrator.hpp"
+#include "StreamlineBuffer.hpp"
+#include "StreamlineCache.hpp"
+#include "StreamlineIntegration.hpp"
+
 using namespace fantom;
+using plugin1::FieldSampler;
+using plugin1::PacketIntegrator;
+using plugin1::Progress;
+using plugin1::UniformGridSampler;
+using plugin1::StreamlineBuffer;
+using plugin1::Termination;
+using plugin1::TerminationStats;
 
 namespace
 {
@@ -25,6 +44,14 @@ namespace
 				add< Field< 3, Vector3 > >( "Field", "A 3D vector field", definedOn< Grid< 3 > >( Grid< 3 >::Points ) );
 				add< double >("Step Size", "Threshold", 0.1);
 				add< size_t >("Step Num", "Radius of Spheres", 50);
+				add< bool >( "Parallel", "Integrate starting points on all cores", true );
+				add< bool >( "SIMD Packets", "Advance four streamlines at once on uniform grids", true );
+				add< double >( "Min Velocity", "Stop lines where the field is slower than this, 0 disables", 0.0 );
+				add< double >( "Max Length", "Stop lines longer than this arc length, 0 disables", 0.0 );
+				add< double >( "Cycle Distance", "Stop lines that come back this close to an earlier part of themselves, 0 disables", 0.0 );
+				add< double >( "Max Line Time", "Milliseconds one line may take, 0 disables", 0.0 );
+				add< bool >( "Evenly Spaced", "Place streamlines evenly instead of one per starting point", false );
+				add< double >( "Separation", "Distance between evenly spaced streamlines", 0.5 );
 
 				add< bool >( "Surface Mode", "Toggle surface mode, where starting points are on defined surface", false );
 
@@ -66,7 +93,7 @@ namespace
 		{
 		}
 
-		virtual void execute( const Algorithm::Options& options, const volatile bool& /*abortFlag*/ ) override {
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
 			// load options
 			auto step_size	= options.get<double>("Step Size");
 			auto steps			= options.get<size_t>("Step Num");
@@ -74,6 +101,12 @@ namespace
 			auto function		= options.get< Function< Vector3 > >( "Field" );
 			if(!field) return;
 
+			// early termination, lines always end when they leave the domain
+			termination.min_velocity   = options.get<double>("Min Velocity");
+			termination.max_length     = options.get<double>("Max Length");
+			termination.cycle_distance = options.get<double>("Cycle Distance");
+			termination.max_seconds    = options.get<double>("Max Line Time") / 1000;
+
 
 
 			// switch between surface mode and grid mode
@@ -101,50 +134,202 @@ namespace
 			}
 
 
-			// linesSet outputs
-			std::vector<Point3> points;
-			std::vector<std::vector<size_t>> indices; 
-			
-			// perform steps for each point in the grid 
-			for (auto point : starting_points) {
-				auto evaluator = field->makeEvaluator();
-				perform_steps(std::move(evaluator), points, indices, point, steps, step_size);
+			StreamlineBuffer lines;
+			TerminationStats stats;
+			bool finished;
+			if (options.get<bool>("Evenly Spaced")) {
+				cache.clear();
+				finished = trace_evenly_spaced(options, starting_points, *field, *function, steps, step_size, abortFlag, lines, stats);
+			} else {
+				finished = trace_cached(options, starting_points, field, *function, steps, step_size, abortFlag, lines, stats);
 			}
+			if (!finished) return;
+
+			// why the lines ended
+			std::cout << "streamline termination:";
+			for (size_t r = 0; r < plugin1::TERMINATION_NUM; r++)
+				std::cout << " " << plugin1::termination_name(Termination(r)) << " " << stats.count[r] << (r + 1 < plugin1::TERMINATION_NUM ? "," : "");
+			std::cout << std::endl;
 
-			auto lineSet = DomainFactory::makeLineSet(points, indices);
+			// linesSet outputs
+			auto lineSet = lines.make_line_set();
 			setResult( "lines", lineSet );
 		}
 
-		virtual void perform_steps(std::unique_ptr<FieldEvaluator<3, Point3>> evaluator, std::vector<Point3> &points, std::vector<std::vector<size_t>> &indices, Point3 point, size_t steps, double step_size) {
+		// direct trilinear interpolation if the field lives on a uniform grid.
+		// copies the values, so it is only built when lines are integrated
+		static std::unique_ptr<UniformGridSampler<3, Vector3>> make_uniform(const Function<Vector3>& function) {
+			std::unique_ptr<UniformGridSampler<3, Vector3>> uniform;
+			if (auto grid = std::dynamic_pointer_cast<const Grid<3>>(function.domain()))
+				uniform = UniformGridSampler<3, Vector3>::make(*grid, function);
+			return uniform;
+		}
+
+		// one line per starting point. lines of the last execute are reused if
+		// only the step count changed: fewer steps cut the cached lines, more
+		// steps integrate the missing tails
+		bool trace_cached(const Algorithm::Options& options, const std::vector<Point3>& starting_points, const std::shared_ptr<const Field<3, Vector3>>& field,
+			const Function<Vector3>& function, size_t steps, double step_size, const volatile bool& abortFlag,
+			StreamlineBuffer& lines, TerminationStats& stats) {
+			plugin1::StreamlineCache::Key key;
+			key.field		  = field;
+			key.field_address = field.get();
+			key.integrator	  = &typeid(*this);
+			key.parameters	  = { step_size, termination.min_velocity, termination.max_length, termination.cycle_distance };
+			for (double p : method_parameters())
+				key.parameters.push_back(p);
+			key.seeds = starting_points;
+
+			// lines cut by wall time cannot be reproduced, arc length and cycle
+			// rules carry state along the line so those lines cannot be continued
+			bool cacheable = !(termination.max_seconds > 0);
+			bool resumable = !(termination.max_length > 0) && !(termination.cycle_distance > 0);
+
+			if (!cacheable || !cache.matches(key) || (steps > cache.steps() && !resumable)) {
+				std::vector<double> step_sizes(starting_points.size(), step_size);
+				std::vector<Termination> reasons(starting_points.size());
+				StreamlineBuffer fresh;
+				if (!trace_all(options, starting_points, step_sizes, *field, function, steps, abortFlag, fresh, reasons)) return false;
+
+				if (!cacheable) {
+					cache.clear();
+					for (auto reason : reasons)
+						stats.add(reason);
+					lines = std::move(fresh);
+					return true;
+				}
+				cache.store(std::move(key), std::move(fresh), std::move(reasons), std::move(step_sizes), steps);
+			} else if (steps > cache.steps()) {
+				// continue the lines that ran into the old step limit
+				std::vector<size_t> open = cache.open_lines();
+				std::vector<Point3> ends(open.size());
+				std::vector<double> step_sizes(open.size());
+				for (size_t i = 0; i < open.size(); i++) {
+					ends[i]		  = cache.end_point(open[i]);
+					step_sizes[i] = cache.next_step(open[i]);
+				}
+				std::vector<Termination> reasons(open.size());
+				StreamlineBuffer tails;
+				if (!trace_all(options, ends, step_sizes, *field, function, steps - cache.steps(), abortFlag, tails, reasons)) return false;
+				cache.extend(open, tails, reasons, step_sizes, steps);
+			}
+
+			lines = cache.truncated(steps, stats);
+			return true;
+		}
+
+		// one line per seed, `step_sizes` holds the initial step of every seed
+		// and receives the step to continue the line with
+		bool trace_all(const Algorithm::Options& options, const std::vector<Point3>& seeds, std::vector<double>& step_sizes, const Field<3, Vector3>& field,
+			const Function<Vector3>& function, size_t steps, const volatile bool& abortFlag,
+			StreamlineBuffer& lines, std::vector<Termination>& reasons) {
+			auto uniform = make_uniform(function);
+
+			// on uniform grids euler and runge kutta can advance packets of seeds
+			// together, as long as no rule besides the domain exit is active
+			PacketIntegrator::Method method;
+			std::unique_ptr<PacketIntegrator> packets;
+			if (uniform && options.get<bool>("SIMD Packets") && !termination.enabled() && packet_method(method))
+				packets.reset(new PacketIntegrator(*uniform));
+
+			// integrate blocks of seeds on all cores. every thread uses its own
+			// sampler and writes into the buffer of the block, blocks are merged
+			// in seed order so the result does not depend on the number of threads
+			auto parallel = options.get<bool>("Parallel");
+			const size_t block_size = 64;
+			const size_t block_num	= (seeds.size() + block_size - 1) / block_size;
+			std::vector<StreamlineBuffer> block_lines(block_num);
+
+			Progress progress("integrating streamlines", seeds.size());
+			bool finished = plugin1::parallel_for_chunks(seeds.size(), block_size, abortFlag, progress, parallel,
+				[&]() { return FieldSampler<3, Vector3>(uniform.get(), field.makeEvaluator()); },
+				[&](FieldSampler<3, Vector3>& sampler, size_t b, size_t begin, size_t end) {
+					// fixed step methods never change the step, so the block shares one
+					if (packets) {
+						packets->integrate(method, &seeds[begin], end - begin, steps, step_sizes[begin], block_lines[b], &reasons[begin]);
+						return;
+					}
+					for (size_t i = begin; i < end; i++)
+						reasons[i] = perform_steps(sampler, block_lines[b], seeds[i], steps, step_sizes[i]);
+				});
+			if (!finished) return false;
+
+			size_t point_num = 0;
+			for (auto& block : block_lines)
+				point_num += block.num_points();
+			lines.reserve(seeds.size(), point_num);
+			for (auto& block : block_lines) {
+				lines.append(block);
+				block = StreamlineBuffer();
+			}
+			return true;
+		}
+
+		// jobard-lefer placement, the starting points only prime the seed
+		// queue. runs on one core since every line depends on the previous ones
+		bool trace_evenly_spaced(const Algorithm::Options& options, const std::vector<Point3>& starting_points, const Field<3, Vector3>& field,
+			const Function<Vector3>& function, size_t steps, double step_size, const volatile bool& abortFlag,
+			StreamlineBuffer& lines, TerminationStats& stats) {
+			double separation = options.get<double>("Separation");
+			if (!(separation > 0)) {
+				std::cout << "evenly spaced streamlines: Separation has to be positive" << std::endl;
+				return false;
+			}
+
+			// lines stop at half the separating distance to other lines
+			plugin1::SpatialHash hash(separation);
+			termination.separation			= &hash;
+			termination.separation_distance = 0.5 * separation;
+
+			auto uniform = make_uniform(function);
+			FieldSampler<3, Vector3> sampler(uniform.get(), field.makeEvaluator());
+			Progress progress("placing evenly spaced streamlines", starting_points.size());
+			bool finished = plugin1::evenly_spaced_lines(starting_points, separation, hash, abortFlag, progress,
+				[&](const Point3& seed) { Vector3 v; return sampler.sample(seed, v); },
+				[&](const Point3& seed, double direction, StreamlineBuffer& half) {
+					double h = direction * step_size;
+					stats.add(perform_steps(sampler, half, seed, steps, h));
+				},
+				lines);
+
+			termination.separation = nullptr;
+			return finished;
+		}
+
+		// integrates one line, `step_size` receives the step to continue the line with
+		virtual Termination perform_steps(FieldSampler<3, Vector3>& sampler, StreamlineBuffer &lines, Point3 point, size_t steps, double& step_size) {
 			printf("not implemented\n");
+			return plugin1::STEP_LIMIT;
 		};
 
+		// settings of the method besides the step size that change the lines
+		virtual std::vector<double> method_parameters() const {
+			return {};
+		}
+
+		// integrators that can run on the PacketIntegrator return true and set `method`
+		virtual bool packet_method(PacketIntegrator::Method& /*method*/) const {
+			return false;
+		}
+
+		protected:
+		plugin1::TerminationRules termination;
+
+		private:
+		plugin1::StreamlineCache cache;
 	};
 
 	class Euler : public Integrator {
 		public: 
 		Euler( InitData& data ) : Integrator( data ) { }
 
-		void perform_steps(std::unique_ptr<FieldEvaluator<3, Point3>> evaluator, std::vector<Point3> &points, std::vector<std::vector<size_t>> &indices, Point3 point, size_t steps, double step_size) {
-			points.push_back(point);
-			std::vector<size_t> line_indices; 
-
-			// perform `steps` steps
-			for (size_t s = 0; s < steps; s++) { 
-				if (evaluator->reset(point)){
-					// go into direction
-					Point3 v = evaluator->value();
-					point		 = v * step_size + point;
-
-					// add to output vectors
-					line_indices.push_back(points.size() - 1);
-					line_indices.push_back(points.size());
-					points.push_back(point);
-				}
-			}
+		Termination perform_steps(FieldSampler<3, Vector3>& sampler, StreamlineBuffer &lines, Point3 point, size_t steps, double& step_size) {
+			return plugin1::euler_line(sampler, lines, point, steps, step_size, termination);
+		}
 
-			// add line to results
-			indices.push_back(line_indices);
+		bool packet_method(PacketIntegrator::Method& method) const {
+			method = PacketIntegrator::EULER;
+			return true;
 		}
 	};
 	
@@ -152,44 +337,51 @@ namespace
 		public: 
 		RungeKutta( InitData& data ) : Integrator( data ) { }
 		
-		void perform_steps(std::unique_ptr<FieldEvaluator<3, Point3>> evaluator, std::vector<Point3> &points, std::vector<std::vector<size_t>> &indices, Point3 point, size_t steps, double step_size) {
-			// perform range kutta for each point in the grid 
-			points.push_back(point);
-			std::vector<size_t> line_indices; 
-
-			// perform `steps` steps
-			for (size_t s = 0; s < steps; s++) { 
-				if (evaluator->reset(point)){
-					// k1 is step direction at point
-					Point3 k1 = step_size * evaluator->value();
-
-					// k2 is step direction at half a step towards k1
-					if(!evaluator->reset(point + k1 / 2)) break; 
-					Point3 k2 = step_size * evaluator->value();
-
-					// k3 is step direction at half a step towards k2
-					if(!evaluator->reset(point + k2 / 2)) break; 
-					Point3 k3 = step_size * evaluator->value();
-
-					// k4 is step direction at fullstep towards k3
-					if(!evaluator->reset(point + k3)) break; 
-					Point3 k4 = step_size * evaluator->value();
-
-					// calulate full step
-					point = point += (k1 + 2*k2 + 2*k3 + k4) / 6;
-
-					// add to output vectors
-					line_indices.push_back(points.size() - 1);
-					line_indices.push_back(points.size());
-					points.push_back(point);
-				}
+		Termination perform_steps(FieldSampler<3, Vector3>& sampler, StreamlineBuffer &lines, Point3 point, size_t steps, double& step_size) {
+			return plugin1::runge_kutta_line(sampler, lines, point, steps, step_size, termination);
+		}
+
+		bool packet_method(PacketIntegrator::Method& method) const {
+			method = PacketIntegrator::RUNGE_KUTTA;
+			return true;
+		}
+	};
+
+	class DormandPrince : public Integrator {
+		public:
+		struct Options : public Integrator::Options
+		{
+			Options( fantom::Options::Control& control )
+				: Integrator::Options( control )
+			{
+				add< double >( "Tolerance", "Allowed local error per step", 1e-5 );
+				add< double >( "Min Step", "Smallest step size the controller may choose", 1e-4 );
+				add< double >( "Max Step", "Largest step size the controller may choose", 1.0 );
 			}
+		};
 
-			// add line to results
-			indices.push_back(line_indices);
+		DormandPrince( InitData& data ) : Integrator( data ) { }
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			params.tolerance = options.get<double>("Tolerance");
+			params.min_step  = options.get<double>("Min Step");
+			params.max_step  = options.get<double>("Max Step");
+			Integrator::execute(options, abortFlag);
+		}
+
+		Termination perform_steps(FieldSampler<3, Vector3>& sampler, StreamlineBuffer &lines, Point3 point, size_t steps, double& step_size) {
+			return plugin1::dormand_prince_line(sampler, lines, point, steps, step_size, params, termination, &step_size);
 		}
+
+		std::vector<double> method_parameters() const {
+			return { params.tolerance, params.min_step, params.max_step };
+		}
+
+		private:
+		plugin1::DormandPrinceParams params;
 	};
 
 	AlgorithmRegister< Euler >			dummy1( "Grundaufgabe/Euler",			 "Visualize Vectors with euler method" );
 	AlgorithmRegister< RungeKutta > dummy2( "Grundaufgabe/RungeKutta", "Visualize Vectors with euler method" );
+	AlgorithmRegister< DormandPrince > dummy3( "Grundaufgabe/DormandPrince", "Visualize Vectors with adaptive Dormand-Prince method" );
 } 
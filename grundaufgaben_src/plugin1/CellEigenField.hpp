@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/domains/Grid.hpp>
+#include <fantom/datastructures/interfaces/Field.hpp>
+#include <fantom/math.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ChunkedExecution.hpp"
+#include "FieldSampler.hpp"
+#include "PackedTensors.hpp"
+#include "SymmetricEigen.hpp"
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Tensor field that is defined on the cells of a uniform grid, copied into
+	 * packed symmetric tensors (6 floats per cell). The tensors are constant
+	 * per cell, so with `eigen_table` each one is instead decomposed once (in
+	 * parallel, with the batched solver) and stored as 12 packed floats: the
+	 * three eigenvalues in ascending order followed by their eigenvectors.
+	 * The packed tensors are dropped once the table exists, so a cell costs
+	 * either 24 or 48 bytes. A lookup finds the cell arithmetically and reads
+	 * the table, without it it decomposes the packed tensor of the cell.
+	 */
+	class CellEigenField {
+		public:
+		static const size_t stride = 12;
+
+		// returns nullptr if the grid is not a regular lattice, the values are
+		// not defined on its cells or the computation was aborted
+		static std::unique_ptr<CellEigenField> make(const Grid<3>& grid, const Function<Matrix3>& function, const Field<3, Matrix3>& field,
+			bool eigen_table, const volatile bool& abortFlag) {
+			std::unique_ptr<CellEigenField> cells(new CellEigenField());
+			size_t points[3];
+			if (!detect_uniform_lattice(grid, points, cells->origin, cells->spacing)) return nullptr;
+			size_t total = 1;
+			for (size_t d = 0; d < 3; d++) {
+				cells->extent[d]		  = points[d] - 1;
+				cells->inverse_spacing[d] = 1.0 / cells->spacing[d];
+				total *= cells->extent[d];
+			}
+			if (function.makeDiscreteEvaluator()->numValues() != total) return nullptr;
+			if (!cells->same_order(function, field)) return nullptr;
+
+			cells->cell_num = total;
+			if (!pack_tensors(function, 1, true, abortFlag, cells->tensors)) return nullptr;
+			if (!eigen_table) return cells;
+
+			cells->data.resize(stride * total);
+			Progress progress("decomposing cell tensors", total);
+			bool finished = parallel_for_chunks(total, 4096, abortFlag, progress, true,
+				[]() { return 0; },
+				[&](int, size_t, size_t begin, size_t end) {
+					for_each_eigen_block(cells->tensors, begin, end, [&](size_t first, size_t count, const SymmetricEigen* eigen) {
+						for (size_t i = 0; i < count; i++)
+							cells->pack(first + i, eigen[i]);
+					});
+				});
+			if (!finished) return nullptr;
+			cells->tensors = SymmetricTensorArray();
+			return cells;
+		}
+
+		size_t num_cells() const {
+			return cell_num;
+		}
+
+		// index of the cell containing `point`, false outside of the grid
+		bool cell_index(const Point3& point, size_t& index) const {
+			index = 0;
+			size_t step = 1;
+			for (size_t d = 0; d < 3; d++) {
+				double u = (point[d] - origin[d]) * inverse_spacing[d];
+				if (!(u >= 0) || u > extent[d]) return false;
+				size_t i = std::min(static_cast<size_t>(u), extent[d] - 1);
+				index += i * step;
+				step *= extent[d];
+			}
+			return true;
+		}
+
+		// decomposition of the cell containing `point`, false outside of the grid
+		bool lookup(const Point3& point, SymmetricEigen& out) const {
+			size_t index;
+			if (!cell_index(point, index)) return false;
+			out = cell_eigen(index);
+			return true;
+		}
+
+		// decomposition of cell `index`, from the table if there is one
+		SymmetricEigen cell_eigen(size_t index) const {
+			if (data.empty()) return symmetric_eigen(tensors.get(index));
+			SymmetricEigen out;
+			const float* packed = &data[stride * index];
+			for (size_t k = 0; k < 3; k++) {
+				out.values[k]  = packed[k];
+				out.vectors[k] = Vector3(packed[3 + 3 * k], packed[4 + 3 * k], packed[5 + 3 * k]);
+			}
+			return out;
+		}
+
+		// memory of the packed tensors or the eigen table
+		size_t bytes() const {
+			return tensors.bytes() + data.size() * sizeof(float);
+		}
+
+		private:
+		CellEigenField() = default;
+
+		void pack(size_t cell, const SymmetricEigen& eigen) {
+			float* packed = &data[stride * cell];
+			for (size_t k = 0; k < 3; k++) {
+				packed[k] = static_cast<float>(eigen.values[k]);
+				for (size_t d = 0; d < 3; d++)
+					packed[3 + 3 * k + d] = static_cast<float>(eigen.vectors[k][d]);
+			}
+		}
+
+		// the cell index is computed with x running fastest, compare a few
+		// cell centers against the field itself to make sure that matches
+		bool same_order(const Function<Matrix3>& function, const Field<3, Matrix3>& field) const {
+			auto values	   = function.makeDiscreteEvaluator();
+			auto evaluator = field.makeEvaluator();
+			for (size_t fx = 0; fx < 3; fx++)
+				for (size_t fy = 0; fy < 3; fy++)
+					for (size_t fz = 0; fz < 3; fz++) {
+						size_t index[3] = { fx * (extent[0] - 1) / 2, fy * (extent[1] - 1) / 2, fz * (extent[2] - 1) / 2 };
+						Point3 center;
+						for (size_t d = 0; d < 3; d++)
+							center[d] = origin[d] + (index[d] + 0.5) * spacing[d];
+						if (!evaluator->reset(center)) return false;
+						Matrix3 expected = values->value(index[0] + extent[0] * (index[1] + extent[1] * index[2]));
+						Matrix3 actual	 = evaluator->value();
+						for (size_t k = 0; k < 9; k++)
+							if (std::abs(actual[k] - expected[k]) > 1e-9 * (std::abs(expected[k]) + 1)) return false;
+					}
+			return true;
+		}
+
+		size_t extent[3];
+		double origin[3];
+		double spacing[3];
+		double inverse_spacing[3];
+		size_t cell_num = 0;
+		SymmetricTensorArray tensors;
+		std::vector<float> data;
+	};
+
+	/**
+	 * Eigen decomposition of a tensor field at arbitrary points. Reads the
+	 * precomputed cell decomposition if there is one and falls back to
+	 * evaluating and decomposing the field otherwise.
+	 */
+	class TensorSampler {
+		public:
+		TensorSampler(const CellEigenField* cells, std::unique_ptr<FieldEvaluator<3, Matrix3>> evaluator)
+			: cells(cells), evaluator(std::move(evaluator)) { }
+
+		// false outside of the domain
+		bool sample(const Point3& point, SymmetricEigen& out) {
+			if (cells) return cells->lookup(point, out);
+			if (!evaluator->reset(point)) return false;
+			out = symmetric_eigen(symmetric_part(evaluator->value()));
+			return true;
+		}
+
+		private:
+		const CellEigenField* cells;
+		std::unique_ptr<FieldEvaluator<3, Matrix3>> evaluator;
+	};
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/domains/Grid.hpp>
+#include <fantom/datastructures/interfaces/Field.hpp>
+#include <fantom/math.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Point location with a hint for point data on unstructured 2D grids of
+	 * triangles and convex quads. Consecutive queries (the pixels of a
+	 * scanline, the steps of a streamline) mostly land in the same or an
+	 * adjacent cell, so a query starts in the cell of the previous one and
+	 * walks across the edge the point lies behind. Only when the walk leaves
+	 * the grid or takes too long a bucket grid over the cell bounds is
+	 * searched. The tables are read only and can be shared between threads,
+	 * the hint belongs to the caller (see FieldSampler).
+	 */
+	template<size_t D, class T>
+	class CellWalkSampler {
+		public:
+		static constexpr size_t none = SIZE_MAX;
+
+		// returns nullptr for other dimensions or cell types and if the
+		// values are not defined on the points
+		static std::unique_ptr<CellWalkSampler> make(const Grid<D>& grid, const Function<T>& function) {
+			if (D != 2) return nullptr;
+			auto values = function.makeDiscreteEvaluator();
+			const auto& points = grid.points();
+			const size_t point_num = points.size();
+			const size_t cell_num  = grid.numCells();
+			if (values->numValues() != point_num || cell_num == 0) return nullptr;
+
+			std::unique_ptr<CellWalkSampler> sampler(new CellWalkSampler());
+			sampler->xy.resize(2 * point_num);
+			sampler->values.resize(point_num);
+			for (size_t i = 0; i < point_num; i++) {
+				sampler->xy[2 * i + 0] = points[i][0];
+				sampler->xy[2 * i + 1] = points[i][1];
+				sampler->values[i]	   = values->value(i);
+			}
+
+			// corners counterclockwise, so "behind an edge" has one sign
+			sampler->corners.assign(4 * cell_num, none);
+			sampler->sizes.resize(cell_num);
+			for (size_t c = 0; c < cell_num; c++) {
+				Cell cell = grid.cell(c);
+				size_t n  = cell.type() == Cell::Type::TRIANGLE ? 3 : cell.type() == Cell::Type::QUAD ? 4 : 0;
+				if (n == 0 || cell.numVertices() != n) return nullptr;
+				size_t* corner = &sampler->corners[4 * c];
+				for (size_t k = 0; k < n; k++)
+					corner[k] = cell.index(k);
+				sampler->sizes[c] = n;
+				if (sampler->area(c) < 0) std::reverse(corner, corner + n);
+			}
+			sampler->link_neighbours(point_num);
+			sampler->fill_buckets();
+			return sampler;
+		}
+
+		// interpolated value at `point`, false outside of the grid. `hint` is
+		// the cell of the previous query (or `none`) and is updated
+		bool sample(const Point<D>& point, T& value, size_t& hint) const {
+			const double x = point[0], y = point[1];
+			size_t cell = hint < sizes.size() ? walk(x, y, hint) : none;
+			if (cell == none) cell = search(x, y);
+			if (cell == none) return false;
+			hint  = cell;
+			value = interpolate(cell, x, y);
+			return true;
+		}
+
+		private:
+		CellWalkSampler() = default;
+
+		// twice the signed area of a cell
+		double area(size_t cell) const {
+			const size_t n = sizes[cell];
+			double sum = 0;
+			for (size_t e = 0; e < n; e++) {
+				const double* a = &xy[2 * corners[4 * cell + e]];
+				const double* b = &xy[2 * corners[4 * cell + (e + 1) % n]];
+				sum += a[0] * b[1] - b[0] * a[1];
+			}
+			return sum;
+		}
+
+		// > 0 if (x, y) lies left of edge e, i.e. on the inner side
+		double side(size_t cell, size_t e, double x, double y, double& length2) const {
+			const double* a = &xy[2 * corners[4 * cell + e]];
+			const double* b = &xy[2 * corners[4 * cell + (e + 1) % sizes[cell]]];
+			const double ex = b[0] - a[0], ey = b[1] - a[1];
+			length2 = ex * ex + ey * ey;
+			return ex * (y - a[1]) - ey * (x - a[0]);
+		}
+
+		// the edge (x, y) lies furthest behind, `none` if it is inside
+		size_t exit_edge(size_t cell, double x, double y) const {
+			size_t exit	 = none;
+			double worst = 0;
+			for (size_t e = 0; e < sizes[cell]; e++) {
+				double length2;
+				double s = side(cell, e, x, y, length2);
+				if (s < -1e-9 * length2 && s < worst) {
+					worst = s;
+					exit  = e;
+				}
+			}
+			return exit;
+		}
+
+		size_t walk(double x, double y, size_t cell) const {
+			for (size_t step = 0; step < 64; step++) {
+				size_t exit = exit_edge(cell, x, y);
+				if (exit == none) return cell;
+				cell = neighbours[4 * cell + exit];
+				if (cell == none) return none;
+			}
+			return none;
+		}
+
+		size_t search(double x, double y) const {
+			double u = (x - low[0]) * inverse_bucket[0], v = (y - low[1]) * inverse_bucket[1];
+			if (!(u >= 0 && v >= 0) || u > bucket_num[0] || v > bucket_num[1]) return none;
+			size_t i = std::min(static_cast<size_t>(u), bucket_num[0] - 1);
+			size_t j = std::min(static_cast<size_t>(v), bucket_num[1] - 1);
+			size_t b = j * bucket_num[0] + i;
+			for (size_t k = bucket_start[b]; k < bucket_start[b + 1]; k++)
+				if (exit_edge(bucket_cells[k], x, y) == none) return bucket_cells[k];
+			return none;
+		}
+
+		// barycentric for triangles, inverse bilinear (newton) for quads
+		T interpolate(size_t cell, double x, double y) const {
+			const size_t* c = &corners[4 * cell];
+			const double* p0 = &xy[2 * c[0]];
+			const double* p1 = &xy[2 * c[1]];
+			const double* p2 = &xy[2 * c[2]];
+			T value = T();
+			if (sizes[cell] == 3) {
+				double total = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (p1[1] - p0[1]);
+				double w1 = ((x - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (y - p0[1])) / total;
+				double w2 = ((p1[0] - p0[0]) * (y - p0[1]) - (x - p0[0]) * (p1[1] - p0[1])) / total;
+				value += (1 - w1 - w2) * values[c[0]];
+				value += w1 * values[c[1]];
+				value += w2 * values[c[2]];
+				return value;
+			}
+
+			const double* p3 = &xy[2 * c[3]];
+			double s = 0.5, t = 0.5;
+			for (size_t iteration = 0; iteration < 8; iteration++) {
+				double fx = (1 - s) * (1 - t) * p0[0] + s * (1 - t) * p1[0] + s * t * p2[0] + (1 - s) * t * p3[0] - x;
+				double fy = (1 - s) * (1 - t) * p0[1] + s * (1 - t) * p1[1] + s * t * p2[1] + (1 - s) * t * p3[1] - y;
+				double xs = (1 - t) * (p1[0] - p0[0]) + t * (p2[0] - p3[0]);
+				double ys = (1 - t) * (p1[1] - p0[1]) + t * (p2[1] - p3[1]);
+				double xt = (1 - s) * (p3[0] - p0[0]) + s * (p2[0] - p1[0]);
+				double yt = (1 - s) * (p3[1] - p0[1]) + s * (p2[1] - p1[1]);
+				double det = xs * yt - xt * ys;
+				if (det == 0) break;
+				double ds = (fx * yt - xt * fy) / det;
+				double dt = (xs * fy - fx * ys) / det;
+				s -= ds;
+				t -= dt;
+				if (std::abs(ds) + std::abs(dt) < 1e-12) break;
+			}
+			s = std::min(1.0, std::max(0.0, s));
+			t = std::min(1.0, std::max(0.0, t));
+			value += (1 - s) * (1 - t) * values[c[0]];
+			value += s * (1 - t) * values[c[1]];
+			value += s * t * values[c[2]];
+			value += (1 - s) * t * values[c[3]];
+			return value;
+		}
+
+		// cells sharing an edge, found by sorting all edges by their corners
+		void link_neighbours(size_t point_num) {
+			std::vector<std::pair<uint64_t, size_t>> edges;
+			edges.reserve(corners.size());
+			for (size_t c = 0; c < sizes.size(); c++)
+				for (size_t e = 0; e < sizes[c]; e++) {
+					uint64_t a = corners[4 * c + e], b = corners[4 * c + (e + 1) % sizes[c]];
+					edges.emplace_back(std::min(a, b) * point_num + std::max(a, b), 4 * c + e);
+				}
+			std::sort(edges.begin(), edges.end());
+
+			neighbours.assign(4 * sizes.size(), none);
+			for (size_t i = 0; i + 1 < edges.size(); i++)
+				if (edges[i].first == edges[i + 1].first) {
+					neighbours[edges[i].second]		= edges[i + 1].second / 4;
+					neighbours[edges[i + 1].second] = edges[i].second / 4;
+				}
+		}
+
+		// about one bucket per cell, every cell is listed in all buckets its
+		// bounds overlap
+		void fill_buckets() {
+			low[0] = high[0] = xy[0];
+			low[1] = high[1] = xy[1];
+			for (size_t i = 0; i < xy.size(); i += 2)
+				for (size_t d = 0; d < 2; d++) {
+					low[d]	= std::min(low[d], xy[i + d]);
+					high[d] = std::max(high[d], xy[i + d]);
+				}
+			double width  = std::max(high[0] - low[0], 1e-300);
+			double height = std::max(high[1] - low[1], 1e-300);
+			double side	  = std::sqrt(width * height / sizes.size());
+			bucket_num[0] = std::max<size_t>(1, std::min<size_t>(4096, std::ceil(width / side)));
+			bucket_num[1] = std::max<size_t>(1, std::min<size_t>(4096, std::ceil(height / side)));
+			inverse_bucket[0] = bucket_num[0] / width;
+			inverse_bucket[1] = bucket_num[1] / height;
+
+			// bucket range of every cell, counted first and filled second
+			auto range = [&](size_t c, size_t from[2], size_t to[2]) {
+				double lo[2] = { high[0], high[1] }, hi[2] = { low[0], low[1] };
+				for (size_t k = 0; k < sizes[c]; k++)
+					for (size_t d = 0; d < 2; d++) {
+						lo[d] = std::min(lo[d], xy[2 * corners[4 * c + k] + d]);
+						hi[d] = std::max(hi[d], xy[2 * corners[4 * c + k] + d]);
+					}
+				for (size_t d = 0; d < 2; d++) {
+					from[d] = std::min(static_cast<size_t>((lo[d] - low[d]) * inverse_bucket[d]), bucket_num[d] - 1);
+					to[d]	= std::min(static_cast<size_t>((hi[d] - low[d]) * inverse_bucket[d]), bucket_num[d] - 1);
+				}
+			};
+			bucket_start.assign(bucket_num[0] * bucket_num[1] + 1, 0);
+			size_t from[2], to[2];
+			for (size_t c = 0; c < sizes.size(); c++) {
+				range(c, from, to);
+				for (size_t j = from[1]; j <= to[1]; j++)
+					for (size_t i = from[0]; i <= to[0]; i++)
+						bucket_start[j * bucket_num[0] + i + 1]++;
+			}
+			for (size_t b = 1; b < bucket_start.size(); b++)
+				bucket_start[b] += bucket_start[b - 1];
+			bucket_cells.resize(bucket_start.back());
+			std::vector<size_t> fill(bucket_start.begin(), bucket_start.end() - 1);
+			for (size_t c = 0; c < sizes.size(); c++) {
+				range(c, from, to);
+				for (size_t j = from[1]; j <= to[1]; j++)
+					for (size_t i = from[0]; i <= to[0]; i++)
+						bucket_cells[fill[j * bucket_num[0] + i]++] = c;
+			}
+		}
+
+		std::vector<double> xy;			 // 2 per point
+		std::vector<T> values;			 // 1 per point
+		std::vector<size_t> corners;	 // 4 per cell, `none` after a triangle
+		std::vector<unsigned char> sizes; // corners per cell
+		std::vector<size_t> neighbours;	 // 4 per cell, across edge (k, k + 1)
+
+		double low[2], high[2];
+		size_t bucket_num[2];
+		double inverse_bucket[2];
+		std::vector<size_t> bucket_start;
+		std::vector<size_t> bucket_cells;
+	};
+
+	template<size_t D, class T>
+	constexpr size_t CellWalkSampler<D, T>::none;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace plugin1
+{
+	/**
+	 * Thread safe progress counter for long running loops. Prints a line to
+	 * std::cout every time another 10% of the work is done.
+	 */
+	class Progress {
+		public:
+		Progress(std::string name, size_t total) : name(std::move(name)), total(total), done(0) { }
+
+		void advance(size_t n) {
+			if (total == 0) return;
+			size_t before = done.fetch_add(n, std::memory_order_relaxed);
+			size_t step_before = 10 * before / total;
+			size_t step_after  = 10 * (before + n) / total;
+			if (step_after != step_before) {
+				std::lock_guard<std::mutex> lock(print_mutex);
+				std::cout << name << ": " << 10 * std::min<size_t>(step_after, 10) << "%" << std::endl;
+			}
+		}
+
+		private:
+		std::string name;
+		size_t total;
+		std::atomic<size_t> done;
+		std::mutex print_mutex;
+	};
+
+	/**
+	 * Calls `work(begin, end)` for consecutive chunks of [0, count) and checks
+	 * the abort flag between chunks. Chunks should be small enough that one of
+	 * them finishes within a few milliseconds, so aborting stays responsive.
+	 * Returns false if the loop was aborted.
+	 */
+	template<class Work>
+	bool for_each_chunk(size_t count, size_t chunk_size, const volatile bool& abortFlag, Progress& progress, Work work) {
+		for (size_t begin = 0; begin < count; begin += chunk_size) {
+			if (abortFlag) return false;
+			size_t end = std::min(count, begin + chunk_size);
+			work(begin, end);
+			progress.advance(end - begin);
+		}
+		return true;
+	}
+
+	/**
+	 * Parallel version of for_each_chunk. Chunks are handed out dynamically to
+	 * the OpenMP threads, every thread first creates its own state with
+	 * `init()` (e.g. a field evaluator) and then calls
+	 * `work(state, chunk, begin, end)` for each of its chunks. Once an abort is
+	 * seen the remaining chunks are skipped. Returns false if aborted.
+	 */
+	template<class Init, class Work>
+	bool parallel_for_chunks(size_t count, size_t chunk_size, const volatile bool& abortFlag, Progress& progress, bool parallel, Init init, Work work) {
+		const size_t chunk_num = (count + chunk_size - 1) / chunk_size;
+		std::atomic<bool> aborted(false);
+
+		#pragma omp parallel if(parallel)
+		{
+			auto state = init();
+
+			#pragma omp for schedule(dynamic)
+			for (size_t c = 0; c < chunk_num; c++) {
+				if (aborted.load(std::memory_order_relaxed)) continue;
+				if (abortFlag) {
+					aborted.store(true, std::memory_order_relaxed);
+					continue;
+				}
+				size_t begin = c * chunk_size;
+				size_t end   = std::min(count, begin + chunk_size);
+				work(state, c, begin, end);
+				progress.advance(end - begin);
+			}
+		}
+		return !aborted.load();
+	}
+}
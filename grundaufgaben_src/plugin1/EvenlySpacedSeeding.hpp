@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fantom/math.hpp>
+#include <vector>
+
+#include "ChunkedExecution.hpp"
+#include "SpatialHash.hpp"
+#include "StreamlineBuffer.hpp"
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Evenly spaced streamline placement after Jobard and Lefer. A seed is only
+	 * used if no existing line passes closer than `separation`. Every new line
+	 * is traced in both directions by `trace(seed, direction, half)` (direction
+	 * is +1 or -1, the half line is appended to `half`); the tracer is expected
+	 * to stop its line near other lines, see TerminationRules::separation. New
+	 * seeds are then taken at distance `separation` to both sides of each
+	 * vertex of the line, perpendicular to it. The queue is primed from
+	 * `seeds` in order, so regions that are not reached from the first line
+	 * still get covered. `inside(seed)` rejects seeds outside of the domain.
+	 * The spatial hash is filled with the vertices of all finished lines.
+	 * Returns false if aborted.
+	 */
+	template<class Inside, class Trace>
+	bool evenly_spaced_lines(const std::vector<Point3>& seeds, double separation, SpatialHash& hash, const volatile bool& abortFlag, Progress& progress,
+		Inside inside, Trace trace, StreamlineBuffer& lines) {
+		StreamlineBuffer forward, backward;
+
+		// new seeds lie exactly `separation` away from their source line,
+		// the slack keeps rounding from rejecting half of them
+		const double seed_distance = 0.99 * separation;
+		auto try_seed = [&](const Point3& seed) {
+			if (hash.near(seed, seed_distance) || !inside(seed)) return false;
+			forward.clear();
+			backward.clear();
+			trace(seed, 1.0, forward);
+			trace(seed, -1.0, backward);
+
+			// backward half reversed, the seed is the first vertex of both halves
+			for (size_t i = backward.num_points(); i-- > 1;)
+				lines.add_point(backward.vertices[i]);
+			for (auto& p : forward.vertices)
+				lines.add_point(p);
+			lines.end_line();
+
+			size_t l = lines.num_lines() - 1;
+			for (size_t i = lines.line_begin(l); i < lines.line_end(l); i++)
+				hash.insert(lines.vertices[i]);
+			return true;
+		};
+
+		// lines whose neighbourhood has not been seeded yet
+		size_t next = lines.num_lines();
+		return for_each_chunk(seeds.size(), 64, abortFlag, progress, [&](size_t begin, size_t end) {
+			for (size_t s = begin; s < end; s++) {
+				if (!try_seed(seeds[s])) continue;
+
+				while (next < lines.num_lines() && !abortFlag) {
+					size_t l = next++;
+					size_t first = lines.line_begin(l), last = lines.line_end(l);
+					if (last - first < 2) continue;
+
+					for (size_t i = first; i < last; i++) {
+						// tangent from the neighbouring vertices, vertices are copied
+						// since new lines may move the vertex array
+						Point3 point   = lines.vertices[i];
+						Vector3 tangent = lines.vertices[std::min(i + 1, last - 1)] - lines.vertices[std::max(i, first + 1) - 1];
+						double length  = norm(tangent);
+						if (!(length > 0)) continue;
+						tangent = tangent / length;
+
+						// two directions perpendicular to the line
+						Vector3 axis = std::abs(tangent[0]) < 0.9 ? Vector3(1, 0, 0) : Vector3(0, 1, 0);
+						Vector3 u = normalized(cross(tangent, axis));
+						Vector3 w = cross(tangent, u);
+
+						try_seed(point + separation * u);
+						try_seed(point - separation * u);
+						try_seed(point + separation * w);
+						try_seed(point - separation * w);
+					}
+				}
+			}
+		}) && !abortFlag;
+	}
+}
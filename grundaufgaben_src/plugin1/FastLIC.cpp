@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <fantom/algorithm.hpp>
 #include <fantom/datastructures/domains/Grid.hpp>
 #include <fantom/datastructures/interfaces/Field.hpp>
@@ -6,11 +8,14 @@
 #include <fantom/register.hpp>
 #include <iostream>
 #include <memory>
-#include <random>
 
 #include <fantom-plugins/utils/Graphics/Font.hpp>
 #include <fantom-plugins/utils/Graphics/HelperFunctions.hpp>
 
+#include "ChunkedExecution.hpp"
+#include "FieldSampler.hpp"
+#include "LICEngine.hpp"
+
 using namespace fantom;
 using namespace fantom::graphics;
 
@@ -49,9 +54,12 @@ const std::string LICVertexShader = R"(
 const std::string LICFragmentShader = R"(
 	#version 330 core
 
-	uniform sampler2D inField;  // vector texture
+	uniform sampler2D inField;      // unit direction, rg half float
+	uniform sampler2D inNoise;      // white noise, r 8 bit
+	uniform sampler2D inMagnitude;  // field magnitude, r half float
 	uniform int   step_num;			// step num
 	uniform float step_size;		// step size
+	uniform float max_magnitude;    // > 0 colors by magnitude
 	out vec4 out_color;         // Output color
 
 	void main()
@@ -59,25 +67,48 @@ const std::string LICFragmentShader = R"(
 		float acc = 0.0;
 		vec2 pos_forw = gl_FragCoord.xy / textureSize(inField, 0);
 		vec2 pos_back = pos_forw;
+		vec2 start    = pos_forw;
 
 		for(int i = 1; i < step_num; ++i) {
 			// forward
-			vec4 field = texture(inField, pos_forw);
-			acc      += field.z;
-			vec2 dir  = (field.xy - 0.5) * 2;
+			acc      += texture(inNoise, pos_forw).r;
+			vec2 dir  = texture(inField, pos_forw).xy;
 			pos_forw += dir * step_size; 
 			pos_forw  = clamp(pos_forw, vec2(0.0), vec2(1.0));
 
 			// backward
-			field		  = texture(inField, pos_back);
-			acc      += field.z;
-			dir			  = (field.xy - 0.5) * 2;
+			acc      += texture(inNoise, pos_back).r;
+			dir			  = texture(inField, pos_back).xy;
 			pos_back += dir * step_size; 
 			pos_back  = clamp(pos_back, vec2(0.0), vec2(1.0));
 		}
 		
 		float nacc = acc / (step_num * 2);
-		out_color  = vec4(nacc, nacc, nacc, 1.0);
+		vec3 color = vec3(1.0);
+		if (max_magnitude > 0.0)
+			color = mix(vec3(0.2, 0.4, 1.0), vec3(1.0, 0.3, 0.2), clamp(texture(inMagnitude, start).r / max_magnitude, 0.0, 1.0));
+		out_color  = vec4(nacc * color, 1.0);
+	}
+	)";
+
+const std::string imageFragmentShader = R"(
+	#version 330 core
+
+	in vec2 fragTexCoords;
+
+	uniform sampler2D inTexture;    // lic image, r half float
+	uniform sampler2D inMagnitude;  // field magnitude, r half float
+	uniform float max_magnitude;    // > 0 colors by magnitude
+
+	out vec4 out_color;
+
+	void main()
+	{
+		float value = texture( inTexture, fragTexCoords ).r;
+		vec3 color = vec3( 1.0 );
+		if( max_magnitude > 0.0 )
+			color = mix( vec3( 0.2, 0.4, 1.0 ), vec3( 1.0, 0.3, 0.2 ), clamp( texture( inMagnitude, fragTexCoords ).r / max_magnitude, 0.0, 1.0 ) );
+		out_color = vec4( value * color, 1.0 );
 	}
 	)";
 
@@ -213,12 +244,17 @@ class LocalAlgorithm : public VisAlgorithm {
 				add<float>("Step Size", "Stepsize", 0.1);
 				add<Vector2>("Vec1", "vector 1 of plane", Vector2(-10, -10));
 				add<Vector2>("Vec2", "vector 1 of plane", Vector2(10, 10));
+				add<bool>("CPU", "Compute the LIC on the CPU (FastLIC) instead of in the shader", false);
+				add<size_t>("Line Steps", "CPU: steps a streamline runs beyond the filter and deposits its values", 300);
+				add<size_t>("Min Hits", "CPU: values a pixel collects before no more streamlines start there", 2);
+				add<size_t>("Noise Seed", "Seed of the white noise", 0);
+				add<bool>("Color Magnitude", "Color the LIC by the field magnitude", false);
 			}
 		};
 
 		LocalAlgorithm(InitData &init) : VisAlgorithm(init) {}
 
-		void execute(Algorithm::Options const& options, volatile bool const &) override {
+		void execute(Algorithm::Options const& options, volatile bool const& abortFlag) override {
 			// parse options 
 			std::cout << "parsing options" << std::endl;
 			auto step_size = options.get<float>("Step Size");
@@ -227,6 +263,7 @@ class LocalAlgorithm : public VisAlgorithm {
 			Vector2 vec1   = options.get<Vector2>("Vec1");
 			Vector2 vec2   = options.get<Vector2>("Vec2");
 			auto field     = options.get<Field<2, Vector2>>("Field");
+			auto function  = options.get<Function<Vector2>>("Field");
 			if (!field) return;
 
 
@@ -234,12 +271,26 @@ class LocalAlgorithm : public VisAlgorithm {
 			std::cout << "generating textures" << std::endl;
 			Size2D size{res, res};
 			shared_geometry = std::make_shared<GeometryData>(vec1, vec2);
-			auto evaluator    = field->makeEvaluator();
-			auto vecTexture   = generateFieldTexture(size, std::move(evaluator));
-			auto noiseTexture = generateRandomNoiseTexture(size);
+
+			bool cpu = options.get<bool>("CPU");
+			uint64_t seed = options.get<size_t>("Noise Seed");
+			if (!update_textures(field, function, vec1, vec2, res, seed, cpu, abortFlag)) return;
+			report_memory();
+			float color_max = options.get<bool>("Color Magnitude") ? max_magnitude : 0.0f;
+
+			// fastLIC: the finished image is only drawn onto the plane
+			if (cpu) {
+				plugin1::FastLICEngine engine(input, step_num, options.get<size_t>("Line Steps"), step_size * res,
+					options.get<size_t>("Min Hits"));
+				std::vector<float> image;
+				plugin1::Progress progress("fast lic", input.height);
+				if (!engine.run(image, abortFlag, progress)) return;
+				setGraphics("Example", createImage(size, image, color_max));
+				return;
+			}
 
 			// do drawable 
-			auto child = createChild(step_num, step_size, noiseTexture, vecTexture);
+			auto child = createChild(step_num, step_size, color_max);
 			auto drawable = std::make_shared<LocalDrawable>(child, noiseTexture->size(), shared_geometry);
 			setGraphics("Example", drawable);
 		}
@@ -247,9 +298,60 @@ class LocalAlgorithm : public VisAlgorithm {
 	private:
 		std::shared_ptr<GeometryData> shared_geometry;
 
-		std::shared_ptr<Drawable> createChild(size_t step_num, float step_size, 
-				std::shared_ptr<graphics::Texture2D> noiseTexture, 
-				std::shared_ptr<graphics::Texture2D> vecTexture) const 
+		// input of the last execute, kept while only the step parameters
+		// change so those just rebuild the primitive
+		std::weak_ptr<const Field<2, Vector2>> textures_field;
+		Vector2 textures_vec1, textures_vec2;
+		size_t textures_res	   = 0;
+		uint64_t textures_seed = 0;
+		std::shared_ptr<Texture2D> vecTexture, noiseTexture, magnitudeTexture;
+		float max_magnitude = 0;
+		plugin1::LICInput input;
+
+		bool update_textures(const std::shared_ptr<const Field<2, Vector2>>& field, const std::shared_ptr<const Function<Vector2>>& function,
+				Vector2 vec1, Vector2 vec2, size_t res, uint64_t seed, bool cpu, volatile bool const& abortFlag) {
+			bool same = !textures_field.expired() && textures_field.lock() == field && textures_res == res && textures_seed == seed
+				&& textures_vec1[0] == vec1[0] && textures_vec1[1] == vec1[1] && textures_vec2[0] == vec2[0] && textures_vec2[1] == vec2[1];
+			if (same && (!cpu || input.width == res)) {
+				std::cout << "reusing textures" << std::endl;
+				return true;
+			}
+			textures_field.reset();
+			vecTexture.reset();
+			noiseTexture.reset();
+			magnitudeTexture.reset();
+			input = plugin1::LICInput();
+
+			// sample uniform grids directly, walk the cells of unstructured
+			// grids from pixel to pixel, everything else through the evaluator
+			std::unique_ptr<plugin1::UniformGridSampler<2, Vector2>> uniform;
+			std::unique_ptr<plugin1::CellWalkSampler<2, Vector2>> cells;
+			if (auto grid = std::dynamic_pointer_cast<const Grid<2>>(function->domain())) {
+				uniform = plugin1::UniformGridSampler<2, Vector2>::make(*grid, *function);
+				if (!uniform) cells = plugin1::CellWalkSampler<2, Vector2>::make(*grid, *function);
+			}
+
+			Size2D size{res, res};
+			if (!generateInputTextures(size, uniform.get(), cells.get(), *field, seed, abortFlag, cpu ? &input : nullptr)) return false;
+
+			textures_field = field;
+			textures_vec1  = vec1;
+			textures_vec2  = vec2;
+			textures_res   = res;
+			textures_seed  = seed;
+			return true;
+		}
+
+		// bytes of the cached input: RG16F directions, R16F magnitude and R8
+		// noise on the gpu, the engine input on the cpu
+		void report_memory() const {
+			size_t pixels = textures_res * textures_res;
+			size_t gpu	  = vecTexture ? pixels * (4 + 2 + 1) : 0;
+			size_t cpu	  = input.directions.size() * sizeof(float) + input.noise.size();
+			std::cout << "lic input: " << gpu / 1024 << " KiB on the gpu, " << cpu / 1024 << " KiB on the cpu" << std::endl;
+		}
+
+		std::shared_ptr<Drawable> createChild(size_t step_num, float step_size, float color_max) const 
 		{
 			const auto &system = GraphicsSystem::instance();
 			auto bs = graphics::computeBoundingSphere(shared_geometry->verticesTex);
@@ -260,93 +362,107 @@ class LocalAlgorithm : public VisAlgorithm {
 						.vertexBuffer("texCoords", system.makeBuffer(shared_geometry->texCoords))
 						.indexBuffer(system.makeIndexBuffer(shared_geometry->indicesTex))
 						.texture("inField", vecTexture)
+						.texture("inNoise", noiseTexture)
+						.texture("inMagnitude", magnitudeTexture)
 						.uniform("step_num", (int)step_num)
 						.uniform("step_size", step_size)
+						.uniform("max_magnitude", color_max)
 						.boundingSphere(bs),
 				system.makeProgramFromSource(LICVertexShader, LICFragmentShader));
 		}
 
-		std::shared_ptr<Texture2D> generateRandomNoiseTexture(Size2D size) {
-			// Dimensions of the texture
-			const size_t width = size[0];
-			const size_t height = size[1];
-
-			// Create a buffer to store random noise data
-			std::vector<float> noiseData(width * height *
-																	 4); // 4 floats per pixel for RGBA
-
-			// Initialize random number generator
-			std::random_device rd;
-			std::mt19937 generator(rd());
-			std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-
-			// Fill the buffer with random noise
-			for (size_t i = 0; i < noiseData.size(); i += 4) {
-				float value = distribution(generator); // Random grayscale value
-				noiseData[i] = value;                  // Red channel
-				noiseData[i + 1] = value;              // Green channel
-				noiseData[i + 2] = value;              // Blue channel
-				noiseData[i + 3] = 1.0f;               // Alpha channel (opaque)
-			}
-
-			// generate texture
+		std::shared_ptr<Drawable> createImage(Size2D size, const std::vector<float>& image, float color_max) const {
 			const auto &system = GraphicsSystem::instance();
-			auto texture = system.makeTexture(size, graphics::ColorChannel::RGBA);
-			texture->rangeData({0, 0}, size, noiseData);
-			return texture;
+			auto texture = system.makeTexture(size, graphics::ColorChannel::RED, graphics::Precision::FLOAT16);
+			texture->rangeData({0, 0}, size, image);
+			auto bs = graphics::computeBoundingSphere(shared_geometry->verticesTex);
+
+			return system.makePrimitive(
+				graphics::PrimitiveConfig{graphics::RenderPrimitives::TRIANGLES}
+						.vertexBuffer("position", system.makeBuffer(shared_geometry->verticesTex))
+						.vertexBuffer("texCoords", system.makeBuffer(shared_geometry->texCoords))
+						.indexBuffer(system.makeIndexBuffer(shared_geometry->indicesTex))
+						.texture("inTexture", texture)
+						.texture("inMagnitude", magnitudeTexture)
+						.uniform("max_magnitude", color_max)
+						.boundingSphere(bs),
+				system.makeProgramFromSource(texVertexShader, imageFragmentShader));
 		}
 
-		std::shared_ptr<Texture2D> generateFieldTexture(Size2D size, std::unique_ptr<FieldEvaluator<2, Point2>> evaluator) {
+		// samples the field into the direction, magnitude and noise textures.
+		// `lic` additionally receives the directions in pixel space and the
+		// noise for the CPU engine
+		bool generateInputTextures(Size2D size, const plugin1::UniformGridSampler<2, Vector2>* uniform,
+				const plugin1::CellWalkSampler<2, Vector2>* cells, const Field<2, Vector2>& field, uint64_t seed, volatile bool const& abortFlag,
+				plugin1::LICInput* lic = nullptr) {
 			// Init field variables
 			std::cout << "init field" << std::endl;
 			const size_t width = size[0];
 			const size_t height = size[1];
-			std::vector<float> vecData(width * height * 4); 
+			std::vector<float> vecData(width * height * 2, 0.0f);
+			std::vector<float> magnitudeData(width * height, 0.0f);
+			std::vector<uint8_t> noiseData(width * height);
 			auto step = shared_geometry->v2 - shared_geometry->v1; 
 			auto step_x = step[0] / width;
 			auto step_y = step[1] / height;
+			if (lic) {
+				lic->width  = width;
+				lic->height = height;
+				lic->directions.assign(2 * width * height, 0.0f);
+			}
 
-			// Initialize random number generator
-			std::random_device rd;
-			std::mt19937 generator(rd());
-			std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-
-			// interpolate stream vec for each pixel
+			// interpolate stream vec for each pixel, chunks of rows run on all
+			// cores with their own sampler. the noise is hashed from the pixel
+			// index, so the texture does not depend on the thread count
 			std::cout << "fill field data" << std::endl;
-			for (size_t y = 0; y < height; y++ ) {
-				auto y_pos = shared_geometry->v1[1] + step_y * y;
-
-				for (size_t x = 0; x < width; x++ ) {
-					auto x_pos = shared_geometry->v1[0] + step_x * x;
-
-					// default to no direction when not found
-					auto  offset  = 4 * (y * width + x);
-					float random  = distribution(generator); 
-					auto n_stream = Point2(0,0);
-					if(evaluator->reset(Vector2(x_pos, y_pos))){
-						// transform the vectors so they are in [0.0f,1.0f]
-						// v = norm(v) * 0.5 + 0.5
-						auto stream   = evaluator->value();
-						n_stream = (normalized(stream) * 0.5) + Point2(0.5, 0.5);
+			const size_t chunk_size = 16;
+			std::vector<float> chunk_max((height + chunk_size - 1) / chunk_size, 0.0f);
+			plugin1::Progress progress("field texture", height);
+			bool finished = plugin1::parallel_for_chunks(height, chunk_size, abortFlag, progress, true,
+					[&]() { return plugin1::FieldSampler<2, Vector2>(uniform, field.makeEvaluator(), cells); },
+					[&](plugin1::FieldSampler<2, Vector2>& sampler, size_t chunk, size_t begin, size_t end) {
+				for (size_t y = begin; y < end; y++ ) {
+					auto y_pos = shared_geometry->v1[1] + step_y * y;
+
+					for (size_t x = 0; x < width; x++ ) {
+						auto x_pos = shared_geometry->v1[0] + step_x * x;
+						auto pixel = y * width + x;
+						noiseData[pixel] = static_cast<uint8_t>(255.0f * plugin1::white_noise(seed, pixel));
+
+						// default to no direction when not found
+						Vector2 stream;
+						if (!sampler.sample(Vector2(x_pos, y_pos), stream)) continue;
+						double magnitude = norm(stream);
+						if (!(magnitude > 0)) continue;
+						vecData[2 * pixel + 0] = stream[0] / magnitude;
+						vecData[2 * pixel + 1] = stream[1] / magnitude;
+						magnitudeData[pixel]   = magnitude;
+						chunk_max[chunk]	   = std::max<float>(chunk_max[chunk], magnitude);
+
+						if (lic) {
+							Vector2 direction(stream[0] / step_x, stream[1] / step_y);
+							double length = norm(direction);
+							lic->directions[2 * pixel + 0] = direction[0] / length;
+							lic->directions[2 * pixel + 1] = direction[1] / length;
+						}
 					}
-
-					vecData[offset + 0] = n_stream[0];		// x
-					vecData[offset + 1] = n_stream[1];    // y
-					vecData[offset + 2] = random;         // random
-					vecData[offset + 3] = 1.0f;           // alpha
 				}
-			}
+			});
+			if (!finished) return false;
+			max_magnitude = *std::max_element(chunk_max.begin(), chunk_max.end());
 
-			// generate texture
+			// generate textures, half floats and bytes are plenty for unit
+			// vectors and noise
 			const auto &system = GraphicsSystem::instance();
-			auto texture = system.makeTexture(size, graphics::ColorChannel::RGBA);
-			texture->rangeData({0, 0}, size, vecData);
-			return texture;
+			vecTexture = system.makeTexture(size, graphics::ColorChannel::RG, graphics::Precision::FLOAT16);
+			vecTexture->rangeData({0, 0}, size, vecData);
+			magnitudeTexture = system.makeTexture(size, graphics::ColorChannel::RED, graphics::Precision::FLOAT16);
+			magnitudeTexture->rangeData({0, 0}, size, magnitudeData);
+			noiseTexture = system.makeTexture(size, graphics::ColorChannel::RED, graphics::Precision::UINT8);
+			noiseTexture->rangeData({0, 0}, size, noiseData);
+			if (lic) lic->noise = std::move(noiseData);
+			return true;
 		}
-		
-
-
-
 };
 
 AlgorithmRegister<LocalAlgorithm> reg("Hauptaufgabe/FastLIC", "");
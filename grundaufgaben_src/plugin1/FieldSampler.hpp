@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/domains/Grid.hpp>
+#include <fantom/datastructures/interfaces/Field.hpp>
+#include <fantom/math.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "CellWalkSampler.hpp"
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Checks whether the points of `grid` form a regular lattice with x running
+	 * fastest (as made by DomainFactory::makeUniformGrid) and returns the
+	 * number of points, origin and spacing along each axis.
+	 */
+	template<size_t D>
+	bool detect_uniform_lattice(const Grid<D>& grid, size_t extent[D], double origin[D], double spacing[D]) {
+		const auto& points = grid.points();
+		const size_t total = points.size();
+		if (total < 2) return false;
+
+		// true if p lies on the axis through the first point
+		Point<D> first = points[0];
+		auto on_axis = [&](const Point<D>& p, size_t axis) {
+			for (size_t d = 0; d < D; d++)
+				if (d != axis && p[d] != first[d]) return false;
+			return p[axis] != first[axis];
+		};
+
+		// walk along each axis until the lattice wraps around
+		size_t stride[D];
+		size_t s = 1;
+		for (size_t d = 0; d < D; d++) {
+			size_t n = 1;
+			if (d == D - 1) {
+				n = total / s;
+			} else {
+				while (n * s < total && on_axis(points[n * s], d))
+					n++;
+			}
+			if (n < 2) return false;
+			extent[d]  = n;
+			stride[d]  = s;
+			origin[d]  = first[d];
+			spacing[d] = points[s][d] - first[d];
+			if (!(spacing[d] > 0)) return false;
+			s *= n;
+		}
+		if (s != total) return false;
+
+		// check every point against the lattice
+		bool regular = true;
+		#pragma omp parallel for reduction(&&:regular)
+		for (size_t i = 0; i < total; i++) {
+			Point<D> p = points[i];
+			for (size_t d = 0; d < D; d++) {
+				size_t index   = (i / stride[d]) % extent[d];
+				double expected = origin[d] + index * spacing[d];
+				regular = regular && std::abs(p[d] - expected) <= 1e-6 * spacing[d];
+			}
+		}
+		return regular;
+	}
+
+	/**
+	 * Direct sampler for point data on a uniform grid (as made by
+	 * DomainFactory::makeUniformGrid). The cell is found arithmetically from
+	 * origin and spacing, the value is interpolated (bi-/trilinear) straight
+	 * from a copy of the value array.
+	 */
+	template<size_t D, class T>
+	class UniformGridSampler {
+		public:
+		// lattice with x running fastest, `values` holds one value per point
+		UniformGridSampler(const size_t extent[D], const double origin[D], const double spacing[D], std::vector<T> values)
+			: values(std::move(values)) {
+			size_t s = 1;
+			for (size_t d = 0; d < D; d++) {
+				this->extent[d]  = extent[d];
+				this->stride[d]  = s;
+				this->origin[d]  = origin[d];
+				this->spacing[d] = spacing[d];
+				this->inverse_spacing[d] = 1.0 / spacing[d];
+				s *= extent[d];
+			}
+		}
+
+		// returns nullptr if the points of the grid are not a regular lattice
+		// with x running fastest or the values are not defined on the points
+		static std::unique_ptr<UniformGridSampler> make(const Grid<D>& grid, const Function<T>& function) {
+			auto values = function.makeDiscreteEvaluator();
+			const size_t total = grid.points().size();
+			if (values->numValues() != total) return nullptr;
+
+			std::unique_ptr<UniformGridSampler> sampler(new UniformGridSampler());
+			if (!detect_uniform_lattice(grid, sampler->extent, sampler->origin, sampler->spacing)) return nullptr;
+			size_t stride = 1;
+			for (size_t d = 0; d < D; d++) {
+				sampler->stride[d] = stride;
+				sampler->inverse_spacing[d] = 1.0 / sampler->spacing[d];
+				stride *= sampler->extent[d];
+			}
+
+			sampler->values.resize(total);
+			for (size_t i = 0; i < total; i++)
+				sampler->values[i] = values->value(i);
+			return sampler;
+		}
+
+		// interpolated value at `point`, false outside of the grid
+		bool sample(const Point<D>& point, T& value) const {
+			size_t base = 0;
+			double frac[D];
+			for (size_t d = 0; d < D; d++) {
+				double u = (point[d] - origin[d]) * inverse_spacing[d];
+				if (!(u >= 0) || u > extent[d] - 1) return false;
+				size_t i = std::min(static_cast<size_t>(u), extent[d] - 2);
+				frac[d]  = u - i;
+				base		+= i * stride[d];
+			}
+
+			// sum over the 2^D corners of the cell
+			value = T();
+			for (size_t corner = 0; corner < (size_t(1) << D); corner++) {
+				double weight = 1.0;
+				size_t offset = base;
+				for (size_t d = 0; d < D; d++) {
+					if (corner & (size_t(1) << d)) {
+						weight *= frac[d];
+						offset += stride[d];
+					} else {
+						weight *= 1.0 - frac[d];
+					}
+				}
+				value += weight * values[offset];
+			}
+			return true;
+		}
+
+		size_t extent[D];
+		size_t stride[D];
+		double origin[D];
+		double spacing[D];
+		double inverse_spacing[D];
+		std::vector<T> values;
+
+		private:
+		UniformGridSampler() = default;
+	};
+
+	/**
+	 * Samples a field either through the uniform grid fast path (if the domain
+	 * qualifies), the cell walk from the previous sample on unstructured 2D
+	 * grids or through a regular FAnToM evaluator. Not thread safe, every
+	 * thread needs its own FieldSampler; the uniform grid data and the cell
+	 * tables can be shared.
+	 */
+	template<size_t D, class T>
+	class FieldSampler {
+		public:
+		FieldSampler(const UniformGridSampler<D, T>* uniform, std::unique_ptr<FieldEvaluator<D, T>> evaluator,
+			const CellWalkSampler<D, T>* cells = nullptr)
+			: uniform(uniform), cells(cells), evaluator(std::move(evaluator)) { }
+
+		bool sample(const Point<D>& point, T& value) {
+			if (uniform) return uniform->sample(point, value);
+			if (cells) return cells->sample(point, value, hint);
+			if (!evaluator->reset(point)) return false;
+			value = evaluator->value();
+			return true;
+		}
+
+		private:
+		const UniformGridSampler<D, T>* uniform;
+		const CellWalkSampler<D, T>* cells;
+		std::unique_ptr<FieldEvaluator<D, T>> evaluator;
+		size_t hint = CellWalkSampler<D, T>::none;
+	};
+}
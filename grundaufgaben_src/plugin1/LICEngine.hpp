@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ChunkedExecution.hpp"
+
+namespace plugin1
+{
+	/**
+	 * Input of the LIC engines on a width x height pixel raster: the unit
+	 * field direction per pixel (zero where the field is undefined) and an
+	 * 8 bit white noise value per pixel.
+	 */
+	struct LICInput {
+		size_t width  = 0;
+		size_t height = 0;
+		std::vector<float> directions; // 2 per pixel
+		std::vector<uint8_t> noise;   // 1 per pixel
+	};
+
+	/**
+	 * White noise value in [0, 1) of pixel `index`, a hash (splitmix64) of
+	 * seed and index instead of a sequential generator, so every pixel gets
+	 * the same value no matter which thread fills it.
+	 */
+	inline float white_noise(uint64_t seed, uint64_t index) {
+		uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ull;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		z = z ^ (z >> 31);
+		return (z >> 40) * (1.0f / 16777216.0f);
+	}
+
+	/**
+	 * FastLIC (Stalling and Hege) on the CPU. Instead of convolving a fresh
+	 * streamline for every pixel, one long streamline is traced through a
+	 * pixel that is not yet covered, the noise along it is convolved with a
+	 * running box filter and every pixel the line crosses receives the
+	 * filtered value at that point. Pixels that already got `min_hits`
+	 * values start no further lines. The image is split into bands of rows
+	 * that run on all cores, a band only writes its own pixels, so the
+	 * result does not depend on the number of threads.
+	 *
+	 * `kernel` is the half length of the filter in steps, `extension` the
+	 * number of steps a line runs beyond the kernel in each direction and
+	 * `step` the step length in pixels.
+	 */
+	class FastLICEngine {
+		public:
+		FastLICEngine(const LICInput& input, size_t kernel, size_t extension, double step, size_t min_hits)
+			: input(input), kernel(kernel), extension(extension), step(step), min_hits(std::max<size_t>(1, min_hits)) { }
+
+		// gray values in [0, 1] per pixel, false if aborted
+		bool run(std::vector<float>& image, const volatile bool& abortFlag, Progress& progress) const {
+			image.assign(input.width * input.height, 0.0f);
+			const size_t band = 128;
+			bool finished = parallel_for_chunks(input.height, band, abortFlag, progress, true,
+				[]() { return Line(); },
+				[&](Line& line, size_t, size_t begin, size_t end) { run_band(begin, end, line, image, abortFlag); });
+			return finished && !abortFlag;
+		}
+
+		private:
+		// samples of one streamline, backward part reversed in front of the
+		// forward part. kept per thread so the buffers are reused
+		struct Line {
+			std::vector<double> x, y;
+			std::vector<float> noise;
+			std::vector<double> back_x, back_y;
+			std::vector<float> back_noise;
+		};
+
+		// a band of long lines on a wide image takes a while, so the abort
+		// flag is checked once per row as well
+		void run_band(size_t row_begin, size_t row_end, Line& line, std::vector<float>& image, const volatile bool& abortFlag) const {
+			const size_t width = input.width;
+			std::vector<float> sum((row_end - row_begin) * width, 0.0f);
+			std::vector<uint16_t> hits((row_end - row_begin) * width, 0);
+
+			for (size_t row = row_begin; row < row_end; row++) {
+				if (abortFlag) return;
+				for (size_t column = 0; column < width; column++) {
+					if (hits[(row - row_begin) * width + column] >= min_hits) continue;
+					size_t center = trace(column + 0.5, row + 0.5, line);
+					deposit(line, center, row_begin, row_end, sum, hits);
+				}
+			}
+
+			for (size_t i = 0; i < sum.size(); i++)
+				image[row_begin * width + i] = hits[i] ? sum[i] / hits[i] : 0.0f;
+		}
+
+		// traces the line through (x, y) kernel + extension steps in both
+		// directions or until it leaves the image, returns the index of the
+		// seed sample
+		size_t trace(double x, double y, Line& line) const {
+			const size_t reach = kernel + extension;
+			line.x.clear(), line.y.clear(), line.noise.clear();
+			line.back_x.clear(), line.back_y.clear(), line.back_noise.clear();
+			follow(x, y, reach, -1.0, line.back_x, line.back_y, line.back_noise);
+
+			// backward samples without the seed, reversed, in front
+			size_t back = line.back_x.size() - 1;
+			line.x.assign(line.back_x.rbegin(), line.back_x.rend() - 1);
+			line.y.assign(line.back_y.rbegin(), line.back_y.rend() - 1);
+			line.noise.assign(line.back_noise.rbegin(), line.back_noise.rend() - 1);
+			follow(x, y, reach, 1.0, line.x, line.y, line.noise);
+			return back;
+		}
+
+		// midpoint steps from (x, y) along `sign` times the field, the first
+		// sample is (x, y) itself
+		void follow(double x, double y, size_t steps, double sign, std::vector<double>& xs, std::vector<double>& ys, std::vector<float>& noise) const {
+			xs.push_back(x), ys.push_back(y), noise.push_back(noise_at(x, y));
+			double h = sign * step;
+			for (size_t i = 0; i < steps; i++) {
+				double dx, dy;
+				if (!direction(x, y, dx, dy)) return;
+				double mx, my;
+				if (!direction(x + 0.5 * h * dx, y + 0.5 * h * dy, mx, my)) return;
+				x += h * mx;
+				y += h * my;
+				if (!inside(x, y)) return;
+				xs.push_back(x), ys.push_back(y), noise.push_back(noise_at(x, y));
+			}
+		}
+
+		// running box filter over the samples, every sample within
+		// `extension` of the seed writes the filter value into its pixel
+		void deposit(const Line& line, size_t center, size_t row_begin, size_t row_end, std::vector<float>& sum,
+			std::vector<uint16_t>& hits) const {
+			const long n = line.noise.size();
+			const long c = center;
+			const long first = std::max(0L, c - static_cast<long>(extension));
+			const long last	 = std::min(n - 1, c + static_cast<long>(extension));
+			const long k	 = kernel;
+
+			// window [i - k, i + k] clamped to the line
+			double window = 0;
+			long low = std::max(0L, first - k), high = std::min(n - 1, first + k);
+			for (long j = low; j <= high; j++)
+				window += line.noise[j];
+
+			for (long i = first; i <= last; i++) {
+				if (i > first) {
+					if (i + k < n) window += line.noise[i + k], high++;
+					if (i - k - 1 >= 0) window -= line.noise[i - k - 1], low++;
+				}
+				size_t column = static_cast<size_t>(line.x[i]);
+				size_t row	  = static_cast<size_t>(line.y[i]);
+				if (row < row_begin || row >= row_end || column >= input.width) continue;
+				size_t p = (row - row_begin) * input.width + column;
+				if (hits[p] == UINT16_MAX) continue;
+				sum[p] += static_cast<float>(window / (high - low + 1));
+				hits[p]++;
+			}
+		}
+
+		bool inside(double x, double y) const {
+			return x >= 0 && y >= 0 && x < input.width && y < input.height;
+		}
+
+		float noise_at(double x, double y) const {
+			size_t column = std::min(static_cast<size_t>(x), input.width - 1);
+			size_t row	  = std::min(static_cast<size_t>(y), input.height - 1);
+			return input.noise[row * input.width + column] * (1.0f / 255.0f);
+		}
+
+		// bilinear direction at pixel coordinates (x, y), normalized. false
+		// outside of the image or where the field vanishes
+		bool direction(double x, double y, double& dx, double& dy) const {
+			if (!inside(x, y)) return false;
+			double u = std::max(0.0, x - 0.5), v = std::max(0.0, y - 0.5);
+			size_t i = std::min(static_cast<size_t>(u), input.width - 1);
+			size_t j = std::min(static_cast<size_t>(v), input.height - 1);
+			size_t i1 = std::min(i + 1, input.width - 1), j1 = std::min(j + 1, input.height - 1);
+			double fu = std::min(1.0, u - i), fv = std::min(1.0, v - j);
+
+			const float* d = input.directions.data();
+			auto at = [&](size_t a, size_t b, size_t axis) { return d[2 * (b * input.width + a) + axis]; };
+			dx = (1 - fv) * ((1 - fu) * at(i, j, 0) + fu * at(i1, j, 0)) + fv * ((1 - fu) * at(i, j1, 0) + fu * at(i1, j1, 0));
+			dy = (1 - fv) * ((1 - fu) * at(i, j, 1) + fu * at(i1, j, 1)) + fv * ((1 - fu) * at(i, j1, 1) + fu * at(i1, j1, 1));
+			double length = std::sqrt(dx * dx + dy * dy);
+			if (!(length > 1e-6)) return false;
+			dx /= length;
+			dy /= length;
+			return true;
+		}
+
+		const LICInput& input;
+		size_t kernel;
+		size_t extension;
+		double step;
+		size_t min_hits;
+	};
+}
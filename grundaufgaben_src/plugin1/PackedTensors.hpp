@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/interfaces/Field.hpp>
+#include <fantom/math.hpp>
+#include <vector>
+
+#include "ChunkedExecution.hpp"
+#include "SymmetricEigen.hpp"
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Symmetric 3x3 tensors stored as 6 floats each in structure of arrays
+	 * layout, one array per component of the upper triangle. A quarter of the
+	 * memory of 9 doubles, and loops that only touch some components (the
+	 * trace, a single entry) stream just those arrays.
+	 */
+	class SymmetricTensorArray {
+		public:
+		SymmetricTensorArray() = default;
+
+		explicit SymmetricTensorArray(size_t count)
+			: xx(count), xy(count), xz(count), yy(count), yz(count), zz(count) { }
+
+		size_t size() const {
+			return xx.size();
+		}
+
+		SymmetricMatrix3 get(size_t i) const {
+			return SymmetricMatrix3{ xx[i], xy[i], xz[i], yy[i], yz[i], zz[i] };
+		}
+
+		void set(size_t i, const SymmetricMatrix3& m) {
+			xx[i] = static_cast<float>(m.xx);
+			xy[i] = static_cast<float>(m.xy);
+			xz[i] = static_cast<float>(m.xz);
+			yy[i] = static_cast<float>(m.yy);
+			yz[i] = static_cast<float>(m.yz);
+			zz[i] = static_cast<float>(m.zz);
+		}
+
+		size_t bytes() const {
+			return 6 * size() * sizeof(float);
+		}
+
+		std::vector<float> xx, xy, xz, yy, yz, zz;
+	};
+
+	/**
+	 * Copies the symmetric part of every `stride`-th value of `function`
+	 * (e.g. a cell defined tensor field) into `out`, in parallel chunks.
+	 * Passes over all cells (invariants, glyphs, degenerate points) then
+	 * stream 24 bytes per cell instead of 9 doubles. False if aborted.
+	 */
+	inline bool pack_tensors(const Function<Matrix3>& function, size_t stride, bool parallel, const volatile bool& abortFlag, SymmetricTensorArray& out) {
+		stride = std::max<size_t>(1, stride);
+		const size_t count = (function.makeDiscreteEvaluator()->numValues() + stride - 1) / stride;
+		out = SymmetricTensorArray(count);
+		Progress progress("packing tensors", count);
+		return parallel_for_chunks(count, 4096, abortFlag, progress, parallel,
+			[&]() { return function.makeDiscreteEvaluator(); },
+			[&](auto& values, size_t, size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+					out.set(i, symmetric_part(values->value(i * stride)));
+			});
+	}
+
+	/**
+	 * Calls `work(first, count, eigen)` for blocks of at most 64 consecutive
+	 * tensors of [begin, end) with their decompositions. Small blocks keep
+	 * the temporaries of the batched solver on the stack.
+	 */
+	template<class Work>
+	void for_each_eigen_block(const SymmetricTensorArray& tensors, size_t begin, size_t end, Work work) {
+		const size_t block = 64;
+		SymmetricMatrix3 matrices[block];
+		SymmetricEigen eigen[block];
+		for (size_t first = begin; first < end; first += block) {
+			size_t count = std::min(block, end - first);
+			for (size_t i = 0; i < count; i++)
+				matrices[i] = tensors.get(first + i);
+			symmetric_eigen_batch(matrices, count, eigen);
+			work(first, count, eigen);
+		}
+	}
+}
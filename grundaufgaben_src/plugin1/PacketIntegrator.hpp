@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fantom/math.hpp>
+#include <limits>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLUGIN1_PACKET_AVX2 1
+#include <immintrin.h>
+#endif
+
+#include "FieldSampler.hpp"
+#include "StreamlineBuffer.hpp"
+#include "StreamlineIntegration.hpp"
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Advances packets of four streamlines in lockstep on a uniform grid. The
+	 * trilinear interpolation and the euler/runge kutta stages run on AVX2
+	 * registers, one lane per seed; lanes whose seed left the grid are masked
+	 * out. The arithmetic follows the scalar kernels operation by operation,
+	 * so the lines match euler_line()/runge_kutta_line() on the same grid.
+	 * Only the domain exit ends a lane early, the other termination rules need
+	 * the scalar kernels. Without AVX2 (checked at runtime) the scalar kernels
+	 * are used.
+	 */
+	class PacketIntegrator {
+		public:
+		enum Method { EULER, RUNGE_KUTTA };
+		static const size_t lanes = 4;
+
+		explicit PacketIntegrator(const UniformGridSampler<3, Vector3>& grid)
+			: grid(grid), simd(false) {
+#ifdef PLUGIN1_PACKET_AVX2
+			simd = __builtin_cpu_supports("avx2")
+				&& grid.values.size() < size_t(std::numeric_limits<int32_t>::max());
+#endif
+			if (!simd) return;
+
+			// structure of arrays copy of the values for the gathers
+			for (size_t c = 0; c < 3; c++) {
+				components[c].resize(grid.values.size());
+				for (size_t i = 0; i < grid.values.size(); i++)
+					components[c][i] = grid.values[i][c];
+			}
+		}
+
+		bool vectorized() const {
+			return simd;
+		}
+
+		// integrates `count` seeds and writes one line per seed in seed order,
+		// `reasons` receives why each line ended
+		void integrate(Method method, const Point3* seeds, size_t count, size_t steps, double step_size, StreamlineBuffer& lines, Termination* reasons) const {
+#ifdef PLUGIN1_PACKET_AVX2
+			if (simd) {
+				std::vector<Point3> lane_points[lanes];
+				for (size_t first = 0; first < count; first += lanes) {
+					size_t n = std::min(size_t(lanes), count - first);
+					int inside = integrate_packet(method, seeds + first, n, steps, step_size, lane_points);
+					for (size_t l = 0; l < n; l++) {
+						for (auto& p : lane_points[l])
+							lines.add_point(p);
+						lines.end_line();
+						lane_points[l].clear();
+						reasons[first + l] = inside & (1 << l) ? STEP_LIMIT : DOMAIN_EXIT;
+					}
+				}
+				return;
+			}
+#endif
+			for (size_t i = 0; i < count; i++) {
+				if (method == EULER)
+					reasons[i] = euler_line(grid, lines, seeds[i], steps, step_size);
+				else
+					reasons[i] = runge_kutta_line(grid, lines, seeds[i], steps, step_size);
+			}
+		}
+
+		private:
+		const UniformGridSampler<3, Vector3>& grid;
+		bool simd;
+		std::vector<double> components[3];
+
+#ifdef PLUGIN1_PACKET_AVX2
+		// trilinear interpolation for four points, returns the mask of the
+		// lanes that are inside of the grid
+		__attribute__((target("avx2")))
+		int sample(const __m256d p[3], __m256d v[3]) const {
+			__m256d inside = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+			__m128i base   = _mm_setzero_si128();
+			__m256d frac[3];
+			for (size_t d = 0; d < 3; d++) {
+				__m256d u = _mm256_mul_pd(_mm256_sub_pd(p[d], _mm256_set1_pd(grid.origin[d])), _mm256_set1_pd(grid.inverse_spacing[d]));
+				inside = _mm256_and_pd(inside, _mm256_cmp_pd(u, _mm256_setzero_pd(), _CMP_GE_OQ));
+				inside = _mm256_and_pd(inside, _mm256_cmp_pd(u, _mm256_set1_pd(double(grid.extent[d] - 1)), _CMP_LE_OQ));
+				__m128i i = _mm_min_epi32(_mm256_cvttpd_epi32(u), _mm_set1_epi32(int(grid.extent[d] - 2)));
+				frac[d] = _mm256_sub_pd(u, _mm256_cvtepi32_pd(i));
+				base    = _mm_add_epi32(base, _mm_mullo_epi32(i, _mm_set1_epi32(int(grid.stride[d]))));
+			}
+			for (size_t c = 0; c < 3; c++)
+				v[c] = _mm256_setzero_pd();
+			int mask = _mm256_movemask_pd(inside);
+			if (!mask) return 0;
+
+			const __m256d one = _mm256_set1_pd(1.0);
+			for (size_t corner = 0; corner < 8; corner++) {
+				__m256d weight = one;
+				int offset = 0;
+				for (size_t d = 0; d < 3; d++) {
+					if (corner & (size_t(1) << d)) {
+						weight  = _mm256_mul_pd(weight, frac[d]);
+						offset += int(grid.stride[d]);
+					} else {
+						weight  = _mm256_mul_pd(weight, _mm256_sub_pd(one, frac[d]));
+					}
+				}
+				__m128i index = _mm_add_epi32(base, _mm_set1_epi32(offset));
+				for (size_t c = 0; c < 3; c++)
+					// lanes outside of the grid are masked out of the gather
+					v[c] = _mm256_add_pd(v[c], _mm256_mul_pd(weight,
+						_mm256_mask_i32gather_pd(_mm256_setzero_pd(), components[c].data(), index, inside, 8)));
+			}
+			return mask;
+		}
+
+		// returns the mask of the lanes that never left the grid
+		__attribute__((target("avx2")))
+		int integrate_packet(Method method, const Point3* seeds, size_t n, size_t steps, double step_size, std::vector<Point3>* out) const {
+			// unused lanes start on the seed of lane 0 but are never active
+			alignas(32) double coords[3][lanes];
+			int active = 0;
+			for (size_t l = 0; l < lanes; l++) {
+				const Point3& seed = seeds[l < n ? l : 0];
+				for (size_t d = 0; d < 3; d++)
+					coords[d][l] = seed[d];
+				if (l < n) {
+					active |= 1 << l;
+					out[l].push_back(seed);
+				}
+			}
+
+			__m256d p[3], v[3], k1[3], k2[3], k3[3], k4[3], q[3];
+			for (size_t d = 0; d < 3; d++)
+				p[d] = _mm256_load_pd(coords[d]);
+			const __m256d h    = _mm256_set1_pd(step_size);
+			const __m256d half = _mm256_set1_pd(0.5);
+			const __m256d two  = _mm256_set1_pd(2.0);
+			const __m256d six  = _mm256_set1_pd(6.0);
+
+			for (size_t s = 0; s < steps && active; s++) {
+				active &= sample(p, v);
+				if (method == EULER) {
+					for (size_t d = 0; d < 3; d++)
+						p[d] = _mm256_add_pd(_mm256_mul_pd(v[d], h), p[d]);
+				} else {
+					for (size_t d = 0; d < 3; d++) {
+						k1[d] = _mm256_mul_pd(h, v[d]);
+						q[d]  = _mm256_add_pd(p[d], _mm256_mul_pd(k1[d], half));
+					}
+					active &= sample(q, v);
+					for (size_t d = 0; d < 3; d++) {
+						k2[d] = _mm256_mul_pd(h, v[d]);
+						q[d]  = _mm256_add_pd(p[d], _mm256_mul_pd(k2[d], half));
+					}
+					active &= sample(q, v);
+					for (size_t d = 0; d < 3; d++) {
+						k3[d] = _mm256_mul_pd(h, v[d]);
+						q[d]  = _mm256_add_pd(p[d], k3[d]);
+					}
+					active &= sample(q, v);
+					for (size_t d = 0; d < 3; d++) {
+						k4[d] = _mm256_mul_pd(h, v[d]);
+						__m256d sum = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(k1[d], _mm256_mul_pd(two, k2[d])), _mm256_mul_pd(two, k3[d])), k4[d]);
+						p[d] = _mm256_add_pd(p[d], _mm256_div_pd(sum, six));
+					}
+				}
+
+				// only lanes that are still inside take the step
+				for (size_t d = 0; d < 3; d++)
+					_mm256_store_pd(coords[d], p[d]);
+				for (size_t l = 0; l < n; l++)
+					if (active & (1 << l))
+						out[l].push_back(Point3(coords[0][l], coords[1][l], coords[2][l]));
+			}
+			return active;
+		}
+#endif
+	};
+}
@@ -9,11 +9,23 @@
 #include <fantom/dataset.hpp>
 #include <fantom/datastructures/domains/Grid.hpp>
 #include <fantom/datastructures/interfaces/Field.hpp>
+#include <iostream>
 #include <memory>
+#include <random>
 #include <vector>
-#include <Eigen/Dense>
+
+#include "CellEigenField.hpp"
+#include "ChunkedExecution.hpp"
+#include "PackedTensors.hpp"
+#include "StreamlineBuffer.hpp"
+#include "SymmetricEigen.hpp"
 
 using namespace fantom;
+using plugin1::CellEigenField;
+using plugin1::Progress;
+using plugin1::StreamlineBuffer;
+using plugin1::SymmetricEigen;
+using plugin1::TensorSampler;
 
 namespace
 {
@@ -27,8 +39,27 @@ namespace
 				add< Field< 3, Matrix3 > >( "Field", "A 3D Tensor field", definedOn< Grid< 3 > >( Grid< 3 >::Cells ) );
 				add< double >("Step Size", "Threshold", 0.1);
 				add< size_t >("Step Num", "Number of steps", 50);
+				add< size_t >("Order", "Step order: 1 euler, 2 midpoint, 4 classic runge kutta. Other values use the next lower of these", 1);
+				add< bool >( "Eigen Table", "Store the eigenvectors of every cell (48 bytes) so tracing only looks them up. Off halves the memory and decomposes the packed tensor (24 bytes) per step", true );
+
+				add< bool >( "Parallel", "Trace seeds and find degenerate cells on all cores", true );
 
+				// without any seeding strategy a single line starts at Position
 				add< Point3 >( "Position", "position of Plane", Point3(0, 0, 0) );
+				add< bool >( "Plane Seeds", "Seed on the plane spanned by Vector1 and Vector2 at Position", false );
+				add< Vector3 >( "Vector1", "vector 1 of plane", Vector3(1, 0, 0) );
+				add< Vector3 >( "Vector2", "vector 2 of plane", Vector3(0, 1, 0) );
+				add< bool >( "Cell Seeds", "Seed at the cell centers", false );
+				add< size_t >( "Cell Stride", "Use every n-th cell center", 1 );
+				add< bool >( "Random Seeds", "Seed randomly inside the box between ROI Min and ROI Max", false );
+				add< Point3 >( "ROI Min", "lower corner of the seed region", Point3(0, 0, 0) );
+				add< Point3 >( "ROI Max", "upper corner of the seed region", Point3(1, 1, 1) );
+				add< size_t >( "Seed Number", "Number of plane and random seeds", 1000 );
+				add< double >( "Min Anisotropy", "Skip seeds with a lower fractional anisotropy, 0 disables", 0.0 );
+
+				// lines end near degenerate points instead of oscillating there
+				add< double >( "Degeneracy Threshold", "Relative eigenvalue gap below which a cell counts as degenerate, 0 disables", 0.0 );
+				add< double >( "Max Turn", "Stop lines whose direction turns by more degrees in one step, 0 disables", 0.0 );
 
 				add< bool >( "Major", "Toggle surface mode, where starting points are on defined surface", true );
 				add< bool >( "Minor", "Toggle surface mode, where starting points are on defined surface", false );
@@ -46,6 +77,7 @@ namespace
 				add<LineSet<3>>( "Major" );
 				add<LineSet<3>>( "Median" );
 				add<LineSet<3>>( "Minor" );
+				add<PointSet<3>>( "Degenerate Points" );
 			}
 		};
 
@@ -54,12 +86,12 @@ namespace
 		{
 		}
 
-		virtual void execute( const Algorithm::Options& options, const volatile bool& /*abortFlag*/ ) override {
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
 			// load options
-			auto position		= options.get< Point3 >( "Position" );
 			auto step_size	= options.get<double>("Step Size");
 			auto steps			= options.get<size_t>("Step Num");
 			auto field			= options.get< Field< 3, Matrix3 > >( "Field" );
+			auto function		= options.get< Function< Matrix3 > >( "Field" );
 			auto major	= options.get<bool>("Major");
 			auto median	= options.get<bool>("Median");
 			auto minor	= options.get<bool>("Minor");
@@ -69,61 +101,85 @@ namespace
 			if (minor)  modes.push_back(MINOR);
 			if (median) modes.push_back(MEDIAN);
 
-			for (auto mode: modes){
-				std::vector<Point3> points{};
-				std::vector<std::vector<size_t>> indices{};
-				auto evaluator = field->makeEvaluator();
-				if(!evaluator->reset(position))
-					break;
+			if(!field) return;
+			auto requested_order = options.get<size_t>("Order");
+			order = requested_order >= 4 ? 4 : requested_order >= 2 ? 2 : 1;
+			if (order != requested_order)
+				std::cout << "hyperstreamlines: order " << requested_order << " is not supported, using " << order << std::endl;
+			degeneracy_threshold = options.get<double>("Degeneracy Threshold");
+			auto max_turn		 = options.get<double>("Max Turn");
+			min_turn_cos		 = max_turn > 0 ? std::cos(max_turn * M_PI / 180) : -1.0;
+
+			// pack (and decompose) the cell tensors once, tracing then only looks them up
+			update_cells(field, function, options.get<bool>("Eigen Table"), abortFlag);
+			if (abortFlag) return;
+
+			if (degeneracy_threshold > 0) {
+				if (!update_degenerate(field, function, options.get<bool>("Parallel"), abortFlag)) return;
+				setResult( "Degenerate Points", DomainFactory::makePointSet(degenerate_points) );
+			} else {
+				clearResult( "Degenerate Points" );
+			}
+
+			std::vector<Point3> seeds = make_seeds(options, function);
+			auto min_anisotropy = options.get<double>("Min Anisotropy");
+
+			// trace blocks of seeds on all cores, every thread uses its own
+			// sampler and writes into the buffers of the block. the seed is
+			// decomposed once for all modes, after that the modes follow
+			// different eigenvectors
+			const size_t block_size = 64;
+			const size_t block_num	= (seeds.size() + block_size - 1) / block_size;
+			std::vector<std::vector<StreamlineBuffer>> block_lines(modes.size(), std::vector<StreamlineBuffer>(block_num));
+
+			Progress progress("tracing hyperstreamlines", seeds.size());
+			bool finished = plugin1::parallel_for_chunks(seeds.size(), block_size, abortFlag, progress, options.get<bool>("Parallel"),
+				[&]() { return TensorSampler(cells.get(), field->makeEvaluator()); },
+				[&](TensorSampler& sampler, size_t b, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++) {
+						SymmetricEigen seed;
+						if (!sampler.sample(seeds[i], seed)) continue;
+						if (min_anisotropy > 0 && plugin1::fractional_anisotropy(seed.values) < min_anisotropy) continue;
+						for (size_t m = 0; m < modes.size(); m++)
+							trace_mode(sampler, modes[m], seed, seeds[i], steps, step_size, block_lines[m][b], abortFlag);
+					}
+				});
+			if (!finished) return;
+
+			// merge the blocks in seed order
+			std::vector<StreamlineBuffer> lines(modes.size());
+			for (size_t m = 0; m < modes.size(); m++) {
+				size_t line_num = 0, point_num = 0;
+				for (auto& block : block_lines[m]) {
+					line_num  += block.num_lines();
+					point_num += block.num_points();
+				}
+				lines[m].reserve(line_num, point_num);
+				for (auto& block : block_lines[m]) {
+					lines[m].append(block);
+					block = StreamlineBuffer();
+				}
+			}
 
-				// get eigenvectors 
-				auto tensor = evaluator->value();
-				Eigen::Matrix3d stress{
-					{tensor[0], tensor[1], tensor[2]},
-					{tensor[3], tensor[4], tensor[5]}, 
-					{tensor[6], tensor[7], tensor[8]}};
-				Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(stress);
-				auto eigenvectors = solver.eigenvectors();
-				auto eigenvalues  = solver.eigenvalues();
-
-				// get major 
-				auto index = get_index(mode, eigenvalues);
-				if(index == -1) break;
-				auto m  = eigenvectors.col(index);
-				auto ev = Point3(m[0], m[1], m[2]);
-
-				// perform step and decide between two direcitons
-				// take step or -step depending on which is further from previous point
-				auto step = ev * step_size; 
-				auto last_point = position;
-
-				// take step in one direction 
-				auto point      = position + step;
-				perform_steps(std::move(evaluator), mode, indices, points, last_point, point, steps, step_size, true);
-
-				// take step in the other direction 
-				evaluator = field->makeEvaluator();
-				point     = position - step;
-				perform_steps(std::move(evaluator), mode, indices, points, last_point, point, steps, step_size, false);
-
-				// set resulting line
-				auto lines = DomainFactory::makeLineSet(points, indices);
-				switch(mode){
+			// set resulting lines
+			for (size_t m = 0; m < modes.size(); m++) {
+				auto lineSet = lines[m].make_line_set();
+				switch(modes[m]){
 					case Mode::MAJOR:
-						setResult( "Major", lines );
+						setResult( "Major", lineSet );
 						break;
 					case Mode::MEDIAN:
-						setResult( "Median", lines );
+						setResult( "Median", lineSet );
 						break;
 					case Mode::MINOR:
-						setResult( "Minor", lines );
+						setResult( "Minor", lineSet );
 						break;
 				}
 			}
 		}
 
 		enum Mode { MAJOR, MEDIAN, MINOR };
-		int get_index(Mode mode, const Eigen::VectorXd& eigenvalues){
+		int get_index(Mode mode, const double eigenvalues[3]){
 			if(mode == MAJOR) {
 				if(eigenvalues[0] > eigenvalues[1] && eigenvalues[0] > eigenvalues[2])
 					return 0;
@@ -154,64 +210,222 @@ namespace
 			return -1;
 		}
 
-		void perform_steps(std::unique_ptr<FieldEvaluator<3, Matrix3>> evaluator,
+		// eigenvector of `mode` at `point`, flipped to point along `previous`.
+		// false outside of the domain, where the eigenvalue is (nearly) not
+		// unique or where the direction turns too sharply
+		bool direction(TensorSampler& sampler, Mode mode, const Point3& point, const Vector3& previous, Vector3& out) {
+			SymmetricEigen eigen;
+			if (!sampler.sample(point, eigen)) return false;
+			if (degenerate(mode, eigen.values)) return false;
+			auto index = get_index(mode, eigen.values);
+			if (index == -1) return false;
+			out = eigen.vectors[index];
+			double alignment = plugin1::inner(out, previous);
+			if (alignment < 0) out = out * -1.0;
+			return std::abs(alignment) >= min_turn_cos * fantom::norm(previous);
+		}
+
+		// bits of plugin1::degeneracy that make the eigenvector of `mode` undefined
+		bool degenerate(Mode mode, const double values[3]) const {
+			if (degeneracy_threshold <= 0) return false;
+			unsigned mask = mode == MAJOR ? 1 : mode == MINOR ? 2 : 3;
+			return plugin1::degeneracy(values, degeneracy_threshold) & mask;
+		}
+
+		// one step of the chosen order, `k1` is the aligned eigenvector at
+		// `point`. every further stage is aligned with the one before
+		bool advance(TensorSampler& sampler, Mode mode, const Point3& point, const Vector3& k1, double h, Point3& next) {
+			if (order < 2) {
+				next = point + k1 * h;
+				return true;
+			}
+			Vector3 k2;
+			if (!direction(sampler, mode, point + k1 * (h / 2), k1, k2)) return false;
+			if (order < 4) {
+				next = point + k2 * h;
+				return true;
+			}
+			Vector3 k3, k4;
+			if (!direction(sampler, mode, point + k2 * (h / 2), k2, k3)) return false;
+			if (!direction(sampler, mode, point + k3 * h, k3, k4)) return false;
+			next = point + (k1 + k2 * 2.0 + k3 * 2.0 + k4) * (h / 6);
+			return true;
+		}
+
+		// traces from `point` along `heading`, the first step from the seed is
+		// not counted. the sign of every eigenvector is chosen to continue in
+		// the direction of the previous step
+		void perform_steps(TensorSampler& sampler,
 						Mode mode, 
-						std::vector<std::vector<size_t>> &indices, 
-						std::vector<Point3> &points,
-						Point3 last_point,
+						StreamlineBuffer &lines,
 						Point3 point,
+						Vector3 heading,
 						size_t steps,
 						double step_size, 
-						bool forward){
-
-			// push existing line 
-			points.push_back(last_point);
-			std::vector<size_t> line{points.size() - 1, points.size()}; 
-			points.push_back(point);
-			size_t i = 0;
-
-			while(evaluator->reset(point)) {
-				// get eigenvectors 
-				auto tensor = evaluator->value();
-				Eigen::Matrix3d stress{
-					{tensor[0], tensor[1], tensor[2]},
-					{tensor[3], tensor[4], tensor[5]}, 
-					{tensor[6], tensor[7], tensor[8]}};
-				Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(stress);
-				auto eigenvectors = solver.eigenvectors();
-				auto eigenvalues  = solver.eigenvalues();
-
-				// get major (yes this is ugly)
-				auto index = get_index(mode, eigenvalues);
-				if(index == -1) {
+						const volatile bool& abortFlag){
+
+			lines.add_point(point);
+			Vector3 k1 = heading;
+			for (size_t i = 0; i <= steps && !abortFlag; i++) {
+				Point3 next;
+				if (!advance(sampler, mode, point, k1, step_size, next))
 					break;
-				}
-				auto m  = eigenvectors.col(index);
-				auto ev = Point3(m[0], m[1], m[2]);
-
-				// perform step and decide between two direcitons
-				// take step or -step depending on which is further from previous point
-				auto step = ev * step_size; 
-				if(fantom::norm(point + step - last_point) > fantom::norm(point - step - last_point)) {
-					last_point = point;
-					point = point + step; 
-				} else {
-					last_point = point;
-					point = point - step; 
-				}
-				
-				// add to line
-				line.push_back(points.size()-1);
-				line.push_back(points.size());
-				points.push_back(point);
+				Vector3 previous = next - point;
+				point = next;
 
-				// increase
-				if (++i >= steps)
+				// add to line
+				lines.add_point(point);
+				if (i == steps || !direction(sampler, mode, point, previous, k1))
 					break;
 			}
-			indices.push_back(line);
+			lines.end_line();
+		}
+
+		// traces the line of `mode` through `position` in both directions,
+		// `seed` is the decomposition at `position`
+		void trace_mode(TensorSampler& sampler, Mode mode, const SymmetricEigen& seed, Point3 position, size_t steps, double step_size,
+			StreamlineBuffer& lines, const volatile bool& abortFlag) {
+			// get major 
+			auto index = get_index(mode, seed.values);
+			if(index == -1 || degenerate(mode, seed.values)) return;
+			auto ev = seed.vectors[index];
+
+			// one line in each direction of the eigenvector
+			perform_steps(sampler, mode, lines, position, ev, steps, step_size, abortFlag);
+			perform_steps(sampler, mode, lines, position, ev * -1.0, steps, step_size, abortFlag);
+		}
+
+		// seeds of all enabled strategies, or just Position if none is enabled
+		std::vector<Point3> make_seeds(const Algorithm::Options& options, const std::shared_ptr<const Function<Matrix3>>& function) {
+			std::vector<Point3> seeds;
+			auto position		= options.get< Point3 >( "Position" );
+			auto seed_number	= options.get< size_t >( "Seed Number" );
+
+			if (options.get<bool>("Plane Seeds")) {
+				Vector3 vec1 = options.get< Vector3 >( "Vector1" );
+				Vector3 vec2 = options.get< Vector3 >( "Vector2" );
+				size_t max = std::sqrt(seed_number);
+				for (size_t i = 0; i < max; i++)
+					for (size_t j = 0; j < max; j++)
+						seeds.push_back(position + (j * vec1 / max) + (i * vec2 / max));
+			}
+
+			std::shared_ptr<const Grid<3>> grid;
+			if (function) grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain());
+			if (options.get<bool>("Cell Seeds") && grid) {
+				size_t stride = std::max<size_t>(1, options.get<size_t>("Cell Stride"));
+				const auto& points = grid->points();
+				for (size_t c = 0; c < grid->numCells(); c += stride) {
+					Cell cell = grid->cell(c);
+					Point3 center(0, 0, 0);
+					for (size_t k = 0; k < cell.numVertices(); k++)
+						center += points[cell.index(k)];
+					seeds.push_back(center / double(cell.numVertices()));
+				}
+			}
+
+			if (options.get<bool>("Random Seeds")) {
+				auto low	= options.get< Point3 >( "ROI Min" );
+				auto high	= options.get< Point3 >( "ROI Max" );
+				// fixed seed, so the same options give the same lines
+				std::mt19937 generator(0);
+				std::uniform_real_distribution<double> uniform(0.0, 1.0);
+				seeds.reserve(seeds.size() + seed_number);
+				for (size_t i = 0; i < seed_number; i++) {
+					Point3 p;
+					for (size_t d = 0; d < 3; d++)
+						p[d] = low[d] + uniform(generator) * (high[d] - low[d]);
+					seeds.push_back(p);
+				}
+			}
+
+			if (seeds.empty()) seeds.push_back(position);
+			return seeds;
+		}
+
+		// centers of the cells where two eigenvalues coincide, found on all
+		// cores. uses the cell field if there is one
+		bool extract_degenerate(const std::shared_ptr<const Function<Matrix3>>& function, bool parallel, const volatile bool& abortFlag, std::vector<Point3>& points) {
+			if (!function) return true;
+			auto grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain());
+			if (!grid) return true;
+
+			// without the cell table the tensors are packed for this pass
+			plugin1::SymmetricTensorArray tensors;
+			if (!cells && !plugin1::pack_tensors(*function, 1, parallel, abortFlag, tensors)) return false;
+			const size_t count		= cells ? cells->num_cells() : tensors.size();
+			const size_t chunk_size = 4096;
+			std::vector<std::vector<size_t>> chunk_cells((count + chunk_size - 1) / chunk_size);
+			Progress progress("finding degenerate cells", count);
+			bool finished = plugin1::parallel_for_chunks(count, chunk_size, abortFlag, progress, parallel,
+				[]() { return 0; },
+				[&](int, size_t chunk, size_t begin, size_t end) {
+					if (cells) {
+						for (size_t c = begin; c < end; c++)
+							if (plugin1::degeneracy(cells->cell_eigen(c).values, degeneracy_threshold))
+								chunk_cells[chunk].push_back(c);
+						return;
+					}
+					plugin1::for_each_eigen_block(tensors, begin, end, [&](size_t first, size_t n, const SymmetricEigen* eigen) {
+						for (size_t i = 0; i < n; i++)
+							if (plugin1::degeneracy(eigen[i].values, degeneracy_threshold))
+								chunk_cells[chunk].push_back(first + i);
+					});
+				});
+			if (!finished) return false;
+
+			const auto& grid_points = grid->points();
+			for (auto& chunk : chunk_cells)
+				for (size_t c : chunk) {
+					Cell cell = grid->cell(c);
+					Point3 center(0, 0, 0);
+					for (size_t k = 0; k < cell.numVertices(); k++)
+						center += grid_points[cell.index(k)];
+					points.push_back(center / double(cell.numVertices()));
+				}
+			return true;
+		}
+
+		// reruns extract_degenerate only when the field or the threshold changed
+		bool update_degenerate(const std::shared_ptr<const Field<3, Matrix3>>& field, const std::shared_ptr<const Function<Matrix3>>& function,
+			bool parallel, const volatile bool& abortFlag) {
+			if (!degenerate_field.expired() && degenerate_field.lock() == field && degenerate_points_threshold == degeneracy_threshold) return true;
+			degenerate_field.reset();
+			degenerate_points.clear();
+			if (!extract_degenerate(function, parallel, abortFlag, degenerate_points)) return false;
+			degenerate_field			= field;
+			degenerate_points_threshold = degeneracy_threshold;
+			return true;
+		}
+
+		// rebuilds the cell decomposition when the field changed, leaves it
+		// empty (evaluate and decompose per step) if the field is not
+		// defined on the cells of a uniform grid
+		void update_cells(const std::shared_ptr<const Field<3, Matrix3>>& field, const std::shared_ptr<const Function<Matrix3>>& function,
+			bool eigen_table, const volatile bool& abortFlag) {
+			if (!cells_field.expired() && cells_field.lock() == field && cells_eigen_table == eigen_table) return;
+			cells.reset();
+			cells_field.reset();
+			if (!function) return;
+			if (auto grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain()))
+				cells = CellEigenField::make(*grid, *function, *field, eigen_table, abortFlag);
+			if (abortFlag) return;
+			cells_field		  = field;
+			cells_eigen_table = eigen_table;
+			if (cells)
+				std::cout << "cell tensors: " << cells->num_cells() << " cells, " << cells->bytes() / (1024 * 1024) << " MiB" << std::endl;
 		}
 
+		private:
+		size_t order = 1;
+		double degeneracy_threshold = 0;
+		double min_turn_cos = -1;
+		std::unique_ptr<CellEigenField> cells;
+		std::weak_ptr<const Field<3, Matrix3>> cells_field;
+		bool cells_eigen_table = true;
+		std::vector<Point3> degenerate_points;
+		std::weak_ptr<const Field<3, Matrix3>> degenerate_field;
+		double degenerate_points_threshold = 0;
 	};
 	AlgorithmRegister< TensorAlgorithm >			dummy1( "Hauptaufgabe/TensorAlgorithm",	"Tensor Visualization " );
 } 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fantom/math.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Uniform spatial hash over points in 3D. Space is divided into cubic cells
+	 * of `cell_size`, only the occupied cells are stored. Proximity queries up
+	 * to the cell size look at the 27 cells around the query point, so they
+	 * cost O(1) independent of the number of stored points.
+	 */
+	class SpatialHash {
+		public:
+		explicit SpatialHash(double cell_size) : inverse_cell_size(1.0 / cell_size) { }
+
+		void insert(const Point3& point) {
+			cells[key(cell(point[0]), cell(point[1]), cell(point[2]))].push_back(point);
+		}
+
+		// true if a stored point is closer than `distance` (at most the cell size) to `point`
+		bool near(const Point3& point, double distance) const {
+			const int64_t x = cell(point[0]), y = cell(point[1]), z = cell(point[2]);
+			const double squared = distance * distance;
+			for (int64_t dz = -1; dz <= 1; dz++) {
+				for (int64_t dy = -1; dy <= 1; dy++) {
+					for (int64_t dx = -1; dx <= 1; dx++) {
+						auto found = cells.find(key(x + dx, y + dy, z + dz));
+						if (found == cells.end()) continue;
+						for (auto& p : found->second) {
+							Vector3 d = p - point;
+							if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] < squared) return true;
+						}
+					}
+				}
+			}
+			return false;
+		}
+
+		size_t size() const {
+			size_t n = 0;
+			for (auto& c : cells)
+				n += c.second.size();
+			return n;
+		}
+
+		private:
+		int64_t cell(double coordinate) const {
+			return int64_t(std::floor(coordinate * inverse_cell_size));
+		}
+
+		// 21 bits per axis, cells that wrap onto the same key only cost an
+		// extra distance test
+		static uint64_t key(int64_t x, int64_t y, int64_t z) {
+			const uint64_t mask = (uint64_t(1) << 21) - 1;
+			return (uint64_t(x) & mask) | ((uint64_t(y) & mask) << 21) | ((uint64_t(z) & mask) << 42);
+		}
+
+		double inverse_cell_size;
+		std::unordered_map<uint64_t, std::vector<Point3>> cells;
+	};
+}
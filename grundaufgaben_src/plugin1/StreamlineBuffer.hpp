@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/DomainFactory.hpp>
+#include <fantom/math.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Compact storage for many polylines: all vertices live in one flat array
+	 * and line `i` consists of the vertices in [offsets[i], offsets[i + 1]).
+	 * Lines are written front to back with add_point() and closed with end_line().
+	 */
+	class StreamlineBuffer {
+		public:
+		StreamlineBuffer() : offsets{0} { }
+
+		void add_point(const Point3& point) {
+			vertices.push_back(point);
+		}
+
+		void end_line() {
+			offsets.push_back(vertices.size());
+		}
+
+		size_t num_lines() const {
+			return offsets.size() - 1;
+		}
+
+		size_t num_points() const {
+			return vertices.size();
+		}
+
+		size_t line_begin(size_t line) const {
+			return offsets[line];
+		}
+
+		size_t line_end(size_t line) const {
+			return offsets[line + 1];
+		}
+
+		void reserve(size_t lines, size_t points) {
+			offsets.reserve(offsets.size() + lines);
+			vertices.reserve(vertices.size() + points);
+		}
+
+		void clear() {
+			vertices.clear();
+			offsets.assign(1, 0);
+		}
+
+		// append all lines of `other` behind the lines of this buffer
+		void append(const StreamlineBuffer& other) {
+			size_t base = vertices.size();
+			vertices.insert(vertices.end(), other.vertices.begin(), other.vertices.end());
+			for (size_t i = 1; i < other.offsets.size(); i++)
+				offsets.push_back(base + other.offsets[i]);
+		}
+
+		// only at the output boundary the lines are expanded into the index
+		// lists DomainFactory expects, lines with less than two vertices are dropped
+		std::shared_ptr<const LineSet<3>> make_line_set() const {
+			std::vector<std::vector<size_t>> indices;
+			indices.reserve(num_lines());
+			for (size_t l = 0; l < num_lines(); l++) {
+				if (line_end(l) - line_begin(l) < 2) continue;
+				std::vector<size_t> line(line_end(l) - line_begin(l));
+				for (size_t i = 0; i < line.size(); i++)
+					line[i] = line_begin(l) + i;
+				indices.push_back(std::move(line));
+			}
+			return DomainFactory::makeLineSet(vertices, indices);
+		}
+
+		std::vector<Point3> vertices;
+		std::vector<size_t> offsets;
+	};
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fantom/math.hpp>
+#include <memory>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "StreamlineBuffer.hpp"
+#include "StreamlineIntegration.hpp"
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	/**
+	 * Keeps the streamlines of the last execute together with the end state of
+	 * every line (why it ended, the step size to continue with). If only the
+	 * step count changes, a smaller count cuts the stored lines and a larger
+	 * one integrates just the missing tails of the lines that ran into the
+	 * step limit. The stored lines always cover the largest step count seen.
+	 */
+	class StreamlineCache {
+		public:
+		// everything the lines depend on besides the step count
+		struct Key {
+			std::weak_ptr<const void> field;
+			const void* field_address = nullptr;
+			const std::type_info* integrator = nullptr;
+			std::vector<double> parameters;
+			std::vector<Point3> seeds;
+
+			bool operator==(const Key& other) const {
+				if (field.expired() || field_address != other.field_address) return false;
+				if (!integrator || !other.integrator || *integrator != *other.integrator) return false;
+				if (parameters != other.parameters || seeds.size() != other.seeds.size()) return false;
+				for (size_t i = 0; i < seeds.size(); i++)
+					for (size_t d = 0; d < 3; d++)
+						if (seeds[i][d] != other.seeds[i][d]) return false;
+				return true;
+			}
+		};
+
+		bool matches(const Key& other) const {
+			return has_lines && key == other;
+		}
+
+		size_t steps() const {
+			return computed_steps;
+		}
+
+		void clear() {
+			*this = StreamlineCache();
+		}
+
+		// replaces the cache with freshly integrated lines
+		void store(Key key, StreamlineBuffer lines, std::vector<Termination> reasons, std::vector<double> next_steps, size_t steps) {
+			this->key		 = std::move(key);
+			this->lines		 = std::move(lines);
+			this->reasons	 = std::move(reasons);
+			this->next_steps = std::move(next_steps);
+			computed_steps	 = steps;
+			has_lines		 = true;
+		}
+
+		// lines that stopped at the step limit, these are the ones to extend
+		std::vector<size_t> open_lines() const {
+			std::vector<size_t> open;
+			for (size_t l = 0; l < reasons.size(); l++)
+				if (reasons[l] == STEP_LIMIT) open.push_back(l);
+			return open;
+		}
+
+		// end point and step size to continue line `l` with
+		Point3 end_point(size_t l) const {
+			return lines.vertices[lines.line_end(l) - 1];
+		}
+
+		double next_step(size_t l) const {
+			return next_steps[l];
+		}
+
+		// appends `tails` (one line per entry of `open`, each starting at the
+		// end point of its line) and raises the stored step count to `steps`
+		void extend(const std::vector<size_t>& open, const StreamlineBuffer& tails, const std::vector<Termination>& tail_reasons,
+			const std::vector<double>& tail_steps, size_t steps) {
+			StreamlineBuffer extended;
+			extended.reserve(lines.num_lines(), lines.num_points() + tails.num_points());
+			size_t t = 0;
+			for (size_t l = 0; l < lines.num_lines(); l++) {
+				for (size_t i = lines.line_begin(l); i < lines.line_end(l); i++)
+					extended.add_point(lines.vertices[i]);
+				if (t < open.size() && open[t] == l) {
+					for (size_t i = tails.line_begin(t) + 1; i < tails.line_end(t); i++)
+						extended.add_point(tails.vertices[i]);
+					reasons[l]	  = tail_reasons[t];
+					next_steps[l] = tail_steps[t];
+					t++;
+				}
+				extended.end_line();
+			}
+			lines		   = std::move(extended);
+			computed_steps = std::max(computed_steps, steps);
+		}
+
+		// stored lines cut to at most `steps` steps, `stats` counts why the
+		// cut lines ended
+		StreamlineBuffer truncated(size_t steps, TerminationStats& stats) const {
+			StreamlineBuffer result;
+			result.reserve(lines.num_lines(), std::min(lines.num_points(), lines.num_lines() * (steps + 1)));
+			for (size_t l = 0; l < lines.num_lines(); l++) {
+				size_t end = std::min(lines.line_end(l), lines.line_begin(l) + steps + 1);
+				for (size_t i = lines.line_begin(l); i < end; i++)
+					result.add_point(lines.vertices[i]);
+				result.end_line();
+				stats.add(end < lines.line_end(l) ? STEP_LIMIT : reasons[l]);
+			}
+			return result;
+		}
+
+		private:
+		Key key;
+		StreamlineBuffer lines;
+		std::vector<Termination> reasons;
+		std::vector<double> next_steps;
+		size_t computed_steps = 0;
+		bool has_lines		  = false;
+	};
+}
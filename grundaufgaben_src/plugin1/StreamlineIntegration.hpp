@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fantom/math.hpp>
+#include <vector>
+
+#include "SpatialHash.hpp"
+#include "StreamlineBuffer.hpp"
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	// reasons why a streamline ended
+	enum Termination { STEP_LIMIT, DOMAIN_EXIT, MIN_VELOCITY, MAX_LENGTH, CYCLE, WALL_TIME, SEPARATION, TERMINATION_NUM };
+
+	inline const char* termination_name(Termination reason) {
+		static const char* names[] = { "step limit", "domain exit", "min velocity", "max length", "cycle", "wall time", "separation" };
+		return names[reason];
+	}
+
+	// early termination rules, a value of 0 disables a rule. leaving the
+	// domain always ends a line
+	struct TerminationRules {
+		double min_velocity   = 0;
+		double max_length     = 0;
+		double cycle_distance = 0;
+		double max_seconds    = 0;
+
+		// stop when closer than `separation_distance` to a point of other lines
+		const SpatialHash* separation = nullptr;
+		double separation_distance    = 0;
+
+		bool enabled() const {
+			return min_velocity > 0 || max_length > 0 || cycle_distance > 0 || max_seconds > 0 || separation;
+		}
+	};
+
+	// number of lines that ended for each reason
+	struct TerminationStats {
+		size_t count[TERMINATION_NUM] = {};
+
+		void add(Termination reason) {
+			count[reason]++;
+		}
+
+		void merge(const TerminationStats& other) {
+			for (size_t i = 0; i < TERMINATION_NUM; i++)
+				count[i] += other.count[i];
+		}
+	};
+
+	/**
+	 * Checks the termination rules while a single line is traced. Lines that
+	 * run into the rules keep all points up to and including the one where
+	 * the rule fired.
+	 */
+	class LineMonitor {
+		public:
+		LineMonitor(const TerminationRules& rules, const Point3& seed)
+			: rules(rules), active(rules.enabled()), last(seed), behind(rules.cycle_distance > 0 ? rules.cycle_distance : 1.0) {
+			if (rules.max_seconds > 0) start = std::chrono::steady_clock::now();
+			if (rules.cycle_distance > 0) anchors.push_back(Anchor{seed, 0.0});
+		}
+
+		// velocity at the start of a step, false if the line stagnates
+		bool check_velocity(const Vector3& velocity) {
+			if (rules.min_velocity > 0 && fantom::norm(velocity) < rules.min_velocity) {
+				reason = MIN_VELOCITY;
+				return false;
+			}
+			return true;
+		}
+
+		// the line moved on to `point`, false if it has to end there
+		bool check_step(const Point3& point) {
+			if (!active) return true;
+			length += fantom::norm(point - last);
+			last = point;
+			steps++;
+
+			if (rules.max_length > 0 && length >= rules.max_length) {
+				reason = MAX_LENGTH;
+				return false;
+			}
+
+			// closed orbit: back near a part of the line that is well behind us.
+			// every 8th point becomes an anchor, anchors move into the spatial
+			// hash once the line has run on far enough, so a step only looks
+			// at the anchors around it
+			if (rules.cycle_distance > 0) {
+				while (next_anchor < anchors.size() && length - anchors[next_anchor].length > 4 * rules.cycle_distance)
+					behind.insert(anchors[next_anchor++].point);
+				if (behind.near(point, rules.cycle_distance)) {
+					reason = CYCLE;
+					return false;
+				}
+				if (steps % 8 == 0) anchors.push_back(Anchor{point, length});
+			}
+
+			if (rules.separation && rules.separation->near(point, rules.separation_distance)) {
+				reason = SEPARATION;
+				return false;
+			}
+
+			if (rules.max_seconds > 0 && steps % 32 == 0
+				&& std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > rules.max_seconds) {
+				reason = WALL_TIME;
+				return false;
+			}
+			return true;
+		}
+
+		Termination reason = STEP_LIMIT;
+
+		private:
+		struct Anchor {
+			Point3 point;
+			double length;
+		};
+
+		const TerminationRules& rules;
+		bool active;
+		Point3 last;
+		double length = 0;
+		size_t steps  = 0;
+		std::vector<Anchor> anchors;
+		size_t next_anchor = 0;
+		SpatialHash behind;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	// The streamline kernels are templates over the sampler, anything with
+	// `bool sample(const Point3&, Vector3&)` works (FieldSampler,
+	// UniformGridSampler). Every call writes exactly one line into `lines`
+	// and returns why the line ended.
+
+	// explicit euler, `steps` steps of size `step_size`
+	template<class Sampler>
+	Termination euler_line(Sampler& sampler, StreamlineBuffer &lines, Point3 point, size_t steps, double step_size, const TerminationRules& rules = TerminationRules()) {
+		LineMonitor monitor(rules, point);
+		lines.add_point(point);
+
+		// perform `steps` steps
+		for (size_t s = 0; s < steps; s++) { 
+			Vector3 v;
+			if (!sampler.sample(point, v)) {
+				monitor.reason = DOMAIN_EXIT;
+				break;
+			}
+			if (!monitor.check_velocity(v)) break;
+
+			// go into direction
+			point		 = v * step_size + point;
+
+			// add to output line
+			lines.add_point(point);
+			if (!monitor.check_step(point)) break;
+		}
+
+		// add line to results
+		lines.end_line();
+		return monitor.reason;
+	}
+
+	// classic 4th order runge kutta with fixed step size
+	template<class Sampler>
+	Termination runge_kutta_line(Sampler& sampler, StreamlineBuffer &lines, Point3 point, size_t steps, double step_size, const TerminationRules& rules = TerminationRules()) {
+		// perform range kutta for each point in the grid 
+		LineMonitor monitor(rules, point);
+		lines.add_point(point);
+
+		// perform `steps` steps
+		for (size_t s = 0; s < steps; s++) { 
+			Vector3 v;
+			monitor.reason = DOMAIN_EXIT;
+			if (!sampler.sample(point, v)) break;
+			monitor.reason = STEP_LIMIT;
+			if (!monitor.check_velocity(v)) break;
+
+			// k1 is step direction at point
+			Point3 k1 = step_size * v;
+
+			// k2 is step direction at half a step towards k1
+			monitor.reason = DOMAIN_EXIT;
+			if(!sampler.sample(point + k1 / 2, v)) break; 
+			Point3 k2 = step_size * v;
+
+			// k3 is step direction at half a step towards k2
+			if(!sampler.sample(point + k2 / 2, v)) break; 
+			Point3 k3 = step_size * v;
+
+			// k4 is step direction at fullstep towards k3
+			if(!sampler.sample(point + k3, v)) break; 
+			Point3 k4 = step_size * v;
+			monitor.reason = STEP_LIMIT;
+
+			// calulate full step
+			point = point += (k1 + 2*k2 + 2*k3 + k4) / 6;
+
+			// add to output line
+			lines.add_point(point);
+			if (!monitor.check_step(point)) break;
+		}
+
+		// add line to results
+		lines.end_line();
+		return monitor.reason;
+	}
+
+	struct DormandPrinceParams {
+		double tolerance = 1e-5;
+		double min_step  = 1e-4;
+		double max_step  = 1.0;
+	};
+
+	// adaptive RK45 with the Dormand-Prince coefficients, `steps` is the
+	// number of accepted steps and `step_size` the initial step. a negative
+	// `step_size` integrates backwards like in the fixed step kernels.
+	// `next_step` receives the step the controller picked last, passing it
+	// as `step_size` continues the line as if it had not been interrupted
+	template<class Sampler>
+	Termination dormand_prince_line(Sampler& sampler, StreamlineBuffer &lines, Point3 point, size_t steps, double step_size, const DormandPrinceParams& params, const TerminationRules& rules = TerminationRules(), double* next_step = nullptr) {
+		LineMonitor monitor(rules, point);
+		lines.add_point(point);
+
+		const double sign = step_size < 0 ? -1.0 : 1.0;
+		double h = std::min(std::max(std::abs(step_size), params.min_step), params.max_step);
+		Point3 k1, k2, k3, k4, k5, k6, k7;
+		if (!sampler.sample(point, k1)) monitor.reason = DOMAIN_EXIT;
+
+		size_t accepted = 0;
+		while (monitor.reason == STEP_LIMIT && accepted < steps) {
+			if (!monitor.check_velocity(k1)) break;
+
+			// stages 2-6, leaving the domain counts as a failed step
+			const double hs = sign * h;
+			Point3 next;
+			bool inside = sampler.sample(point + hs * (k1 / 5), k2)
+				&& sampler.sample(point + hs * (3.0 / 40 * k1 + 9.0 / 40 * k2), k3)
+				&& sampler.sample(point + hs * (44.0 / 45 * k1 - 56.0 / 15 * k2 + 32.0 / 9 * k3), k4)
+				&& sampler.sample(point + hs * (19372.0 / 6561 * k1 - 25360.0 / 2187 * k2 + 64448.0 / 6561 * k3 - 212.0 / 729 * k4), k5)
+				&& sampler.sample(point + hs * (9017.0 / 3168 * k1 - 355.0 / 33 * k2 + 46732.0 / 5247 * k3 + 49.0 / 176 * k4 - 5103.0 / 18656 * k5), k6);
+
+			// 5th order solution, its derivative is the first stage of the next step (FSAL)
+			if (inside) {
+				next   = point + hs * (35.0 / 384 * k1 + 500.0 / 1113 * k3 + 125.0 / 192 * k4 - 2187.0 / 6784 * k5 + 11.0 / 84 * k6);
+				inside = sampler.sample(next, k7);
+			}
+			if (!inside) {
+				// retry with a smaller step until the step size hits the lower bound
+				if (h <= params.min_step) {
+					monitor.reason = DOMAIN_EXIT;
+					break;
+				}
+				h = std::max(h / 2, params.min_step);
+				continue;
+			}
+
+			// difference between the 5th and the embedded 4th order solution
+			Point3 delta = hs * (71.0 / 57600 * k1 - 71.0 / 16695 * k3 + 71.0 / 1920 * k4 - 17253.0 / 339200 * k5 + 22.0 / 525 * k6 - 1.0 / 40 * k7);
+			double error = fantom::norm(delta);
+
+			// undefined values (NaN, masked) can not be integrated any further
+			if (!std::isfinite(error)) {
+				monitor.reason = DOMAIN_EXIT;
+				break;
+			}
+
+			if (error <= params.tolerance || h <= params.min_step) {
+				point = next;
+				k1    = k7;
+				accepted++;
+
+				// add to output line
+				lines.add_point(point);
+				if (!monitor.check_step(point)) break;
+			}
+
+			// standard step size controller with safety factor
+			// the comparisons send a NaN step to the lower bound
+			double factor = error > 0 ? 0.9 * std::pow(params.tolerance / error, 0.2) : 5.0;
+			factor = factor > 0.2 ? std::min(factor, 5.0) : 0.2;
+			h = h * factor > params.min_step ? std::min(h * factor, params.max_step) : params.min_step;
+			if (!std::isfinite(h)) {
+				monitor.reason = DOMAIN_EXIT;
+				break;
+			}
+		}
+
+		// add line to results
+		lines.end_line();
+		if (next_step) *next_step = sign * h;
+		return monitor.reason;
+	}
+}
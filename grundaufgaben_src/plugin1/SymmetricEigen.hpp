@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fantom/math.hpp>
+#include <utility>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLUGIN1_EIGEN_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace plugin1
+{
+	using namespace fantom;
+
+	// symmetric 3x3 matrix, stored as its upper triangle
+	struct SymmetricMatrix3 {
+		double xx, xy, xz, yy, yz, zz;
+	};
+
+	// symmetric part of a (row major) FAnToM matrix
+	inline SymmetricMatrix3 symmetric_part(const Matrix3& m) {
+		return SymmetricMatrix3{ m[0], 0.5 * (m[1] + m[3]), 0.5 * (m[2] + m[6]), m[4], 0.5 * (m[5] + m[7]), m[8] };
+	}
+
+	inline double inner(const Vector3& a, const Vector3& b) {
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	// eigenvalues in ascending order like Eigen::SelfAdjointEigenSolver,
+	// vectors[i] is the unit eigenvector of values[i]
+	struct SymmetricEigen {
+		double values[3];
+		Vector3 vectors[3];
+	};
+
+	// fractional anisotropy of a tensor with the given eigenvalues, 0 for
+	// isotropic tensors and 1 for tensors with a single nonzero eigenvalue
+	inline double fractional_anisotropy(const double values[3]) {
+		double mean = (values[0] + values[1] + values[2]) / 3;
+		double deviation = 0, magnitude = 0;
+		for (size_t i = 0; i < 3; i++) {
+			deviation += (values[i] - mean) * (values[i] - mean);
+			magnitude += values[i] * values[i];
+		}
+		return magnitude > 0 ? std::sqrt(1.5 * deviation / magnitude) : 0.0;
+	}
+
+	// bit 0 is set if the two largest of the ascending `values` coincide up
+	// to `threshold` times the largest magnitude, bit 1 for the two smallest.
+	// the eigenvectors of coinciding eigenvalues are not defined
+	inline unsigned degeneracy(const double values[3], double threshold) {
+		double scale = threshold * std::max(std::abs(values[0]), std::abs(values[2]));
+		unsigned result = 0;
+		if (values[2] - values[1] <= scale) result |= 1;
+		if (values[1] - values[0] <= scale) result |= 2;
+		return result;
+	}
+
+	/**
+	 * Closed form eigensolver for symmetric 3x3 matrices. The eigenvalues come
+	 * from the trigonometric solution of the characteristic cubic (Cardano) on
+	 * the shifted and scaled matrix. The eigenvector of the eigenvalue that is
+	 * furthest from the middle one is the largest cross product of two rows of
+	 * A - lambda I. The other two are found in the plane orthogonal to it with
+	 * one 2x2 Jacobi rotation, which stays well defined when those two
+	 * eigenvalues (nearly) coincide. Isotropic matrices get the unit vectors.
+	 */
+	inline SymmetricEigen symmetric_eigen(const SymmetricMatrix3& m) {
+		SymmetricEigen result;
+
+		// scale to avoid over- and underflow
+		double scale = std::max({ std::abs(m.xx), std::abs(m.xy), std::abs(m.xz), std::abs(m.yy), std::abs(m.yz), std::abs(m.zz) });
+		double inverse = scale > 0 ? 1.0 / scale : 0.0;
+		double a00 = m.xx * inverse, a01 = m.xy * inverse, a02 = m.xz * inverse;
+		double a11 = m.yy * inverse, a12 = m.yz * inverse, a22 = m.zz * inverse;
+
+		// B = (A - qI) / p has eigenvalues 2 cos(phi + 2 pi k / 3)
+		double q   = (a00 + a11 + a22) / 3;
+		double b00 = a00 - q, b11 = a11 - q, b22 = a22 - q;
+		double p2  = (b00 * b00 + b11 * b11 + b22 * b22 + 2 * (a01 * a01 + a02 * a02 + a12 * a12)) / 6;
+		if (!(p2 > 1e-30)) {
+			for (size_t i = 0; i < 3; i++) {
+				result.values[i]  = q * scale;
+				result.vectors[i] = Vector3(i == 0 ? 1.0 : 0.0, i == 1 ? 1.0 : 0.0, i == 2 ? 1.0 : 0.0);
+			}
+			return result;
+		}
+		double p   = std::sqrt(p2);
+		double det = b00 * (b11 * b22 - a12 * a12) - a01 * (a01 * b22 - a12 * a02) + a02 * (a01 * a12 - b11 * a02);
+		double r   = std::min(std::max(det / (2 * p2 * p), -1.0), 1.0);
+		double phi = std::acos(r) / 3;
+		double c = std::cos(phi), s = std::sin(phi);
+		double largest  = q + 2 * p * c;
+		double smallest = q - p * (c + std::sqrt(3.0) * s);
+		double middle   = 3 * q - largest - smallest;
+
+		// eigenvector of the well separated eigenvalue
+		double first = largest - middle >= middle - smallest ? largest : smallest;
+		Vector3 r0(a00 - first, a01, a02), r1(a01, a11 - first, a12), r2(a02, a12, a22 - first);
+		Vector3 v0 = cross(r0, r1);
+		double n0  = inner(v0, v0);
+		Vector3 candidate = cross(r0, r2);
+		double n = inner(candidate, candidate);
+		if (n > n0) { v0 = candidate; n0 = n; }
+		candidate = cross(r1, r2);
+		n = inner(candidate, candidate);
+		if (n > n0) { v0 = candidate; n0 = n; }
+		v0 = n0 > 0 ? v0 / std::sqrt(n0) : Vector3(1, 0, 0);
+
+		// orthonormal basis u, w of the plane orthogonal to v0
+		double x = std::abs(v0[0]), y = std::abs(v0[1]), z = std::abs(v0[2]);
+		Vector3 u = x <= y && x <= z ? Vector3(0, v0[2], -v0[1]) : y <= z ? Vector3(-v0[2], 0, v0[0]) : Vector3(v0[1], -v0[0], 0);
+		u = u / std::sqrt(inner(u, u));
+		Vector3 w = cross(v0, u);
+
+		// A restricted to the plane, diagonalized by one Jacobi rotation
+		Vector3 au(a00 * u[0] + a01 * u[1] + a02 * u[2], a01 * u[0] + a11 * u[1] + a12 * u[2], a02 * u[0] + a12 * u[1] + a22 * u[2]);
+		Vector3 aw(a00 * w[0] + a01 * w[1] + a02 * w[2], a01 * w[0] + a11 * w[1] + a12 * w[2], a02 * w[0] + a12 * w[1] + a22 * w[2]);
+		double m00 = inner(u, au), m01 = inner(w, au), m11 = inner(w, aw);
+		double t = 0;
+		if (m01 != 0) {
+			double tau = (m11 - m00) / (2 * m01);
+			t = (tau >= 0 ? 1.0 : -1.0) / (std::abs(tau) + std::sqrt(1 + tau * tau));
+		}
+		double cs = 1 / std::sqrt(1 + t * t), sn = t * cs;
+
+		result.values[0]  = first;
+		result.vectors[0] = v0;
+		result.values[1]  = m00 - t * m01;
+		result.vectors[1] = cs * u - sn * w;
+		result.values[2]  = m11 + t * m01;
+		result.vectors[2] = sn * u + cs * w;
+
+		// sorting network for three
+		auto order = [&](size_t i, size_t j) {
+			if (result.values[j] < result.values[i]) {
+				std::swap(result.values[i], result.values[j]);
+				std::swap(result.vectors[i], result.vectors[j]);
+			}
+		};
+		order(0, 1);
+		order(1, 2);
+		order(0, 1);
+		for (size_t i = 0; i < 3; i++)
+			result.values[i] *= scale;
+		return result;
+	}
+
+#ifdef PLUGIN1_EIGEN_AVX2
+	namespace detail
+	{
+		// helpers for the AVX2 solver, they need the target attribute too so
+		// they can be inlined into it
+		#define PLUGIN1_AVX2 __attribute__((target("avx2"))) inline
+
+		PLUGIN1_AVX2 __m256d add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+		PLUGIN1_AVX2 __m256d sub(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+		PLUGIN1_AVX2 __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+		PLUGIN1_AVX2 __m256d abs(__m256d v) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), v); }
+
+		// a where mask is set, b elsewhere
+		PLUGIN1_AVX2 __m256d select(__m256d mask, __m256d a, __m256d b) { return _mm256_blendv_pd(b, a, mask); }
+
+		PLUGIN1_AVX2 void cross3(const __m256d* x, const __m256d* y, __m256d* z) {
+			z[0] = sub(mul(x[1], y[2]), mul(x[2], y[1]));
+			z[1] = sub(mul(x[2], y[0]), mul(x[0], y[2]));
+			z[2] = sub(mul(x[0], y[1]), mul(x[1], y[0]));
+		}
+
+		PLUGIN1_AVX2 __m256d dot3(const __m256d* x, const __m256d* y) {
+			return add(add(mul(x[0], y[0]), mul(x[1], y[1])), mul(x[2], y[2]));
+		}
+
+		// symmetric matrix `a` (upper triangle) times `v`
+		PLUGIN1_AVX2 void apply(const __m256d* a, const __m256d* v, __m256d* av) {
+			av[0] = add(add(mul(a[0], v[0]), mul(a[1], v[1])), mul(a[2], v[2]));
+			av[1] = add(add(mul(a[1], v[0]), mul(a[3], v[1])), mul(a[4], v[2]));
+			av[2] = add(add(mul(a[2], v[0]), mul(a[4], v[1])), mul(a[5], v[2]));
+		}
+
+		// sorting network step, swaps the pairs i and j where value j is smaller
+		PLUGIN1_AVX2 void order(__m256d* values, __m256d (*vectors)[3], size_t i, size_t j) {
+			__m256d swap = _mm256_cmp_pd(values[j], values[i], _CMP_LT_OQ);
+			__m256d vi = values[i];
+			values[i] = select(swap, values[j], vi);
+			values[j] = select(swap, vi, values[j]);
+			for (size_t d = 0; d < 3; d++) {
+				__m256d ei = vectors[i][d];
+				vectors[i][d] = select(swap, vectors[j][d], ei);
+				vectors[j][d] = select(swap, ei, vectors[j][d]);
+			}
+		}
+
+		// symmetric_eigen() for four matrices on AVX2 registers, operation by
+		// operation the same arithmetic. acos/cos/sin are evaluated per lane
+		PLUGIN1_AVX2 void symmetric_eigen_avx2(const SymmetricMatrix3* m, size_t n, SymmetricEigen* out) {
+			alignas(32) double lane[6][4];
+			for (size_t l = 0; l < 4; l++) {
+				const SymmetricMatrix3& s = m[l < n ? l : 0];
+				lane[0][l] = s.xx; lane[1][l] = s.xy; lane[2][l] = s.xz;
+				lane[3][l] = s.yy; lane[4][l] = s.yz; lane[5][l] = s.zz;
+			}
+			const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+			const __m256d two = _mm256_set1_pd(2.0), three = _mm256_set1_pd(3.0);
+
+			// scale to avoid over- and underflow
+			__m256d a[6];
+			__m256d scale = zero;
+			for (size_t i = 0; i < 6; i++) {
+				a[i]  = _mm256_load_pd(lane[i]);
+				scale = _mm256_max_pd(scale, abs(a[i]));
+			}
+			__m256d inverse = select(_mm256_cmp_pd(scale, zero, _CMP_GT_OQ), _mm256_div_pd(one, scale), zero);
+			for (size_t i = 0; i < 6; i++)
+				a[i] = mul(a[i], inverse);
+			const __m256d a00 = a[0], a01 = a[1], a02 = a[2], a11 = a[3], a12 = a[4], a22 = a[5];
+
+			// B = (A - qI) / p has eigenvalues 2 cos(phi + 2 pi k / 3)
+			__m256d q   = _mm256_div_pd(add(add(a00, a11), a22), three);
+			__m256d b00 = sub(a00, q), b11 = sub(a11, q), b22 = sub(a22, q);
+			__m256d p2  = _mm256_div_pd(add(add(add(mul(b00, b00), mul(b11, b11)), mul(b22, b22)),
+				mul(two, add(add(mul(a01, a01), mul(a02, a02)), mul(a12, a12)))), _mm256_set1_pd(6.0));
+			__m256d anisotropic = _mm256_cmp_pd(p2, _mm256_set1_pd(1e-30), _CMP_GT_OQ);
+			p2 = select(anisotropic, p2, one);
+			__m256d p   = _mm256_sqrt_pd(p2);
+			__m256d det = add(sub(mul(b00, sub(mul(b11, b22), mul(a12, a12))), mul(a01, sub(mul(a01, b22), mul(a12, a02)))),
+				mul(a02, sub(mul(a01, a12), mul(b11, a02))));
+			__m256d r = _mm256_min_pd(_mm256_max_pd(_mm256_div_pd(det, mul(mul(two, p2), p)), _mm256_set1_pd(-1.0)), one);
+
+			alignas(32) double lane_r[4], lane_c[4], lane_s[4];
+			_mm256_store_pd(lane_r, r);
+			for (size_t l = 0; l < 4; l++) {
+				double phi = std::acos(lane_r[l]) / 3;
+				lane_c[l] = std::cos(phi);
+				lane_s[l] = std::sin(phi);
+			}
+			__m256d c = _mm256_load_pd(lane_c), s = _mm256_load_pd(lane_s);
+			__m256d largest  = add(q, mul(mul(two, p), c));
+			__m256d smallest = sub(q, mul(p, add(c, mul(_mm256_set1_pd(std::sqrt(3.0)), s))));
+			__m256d middle   = sub(sub(mul(three, q), largest), smallest);
+
+			// eigenvector of the well separated eigenvalue
+			__m256d first = select(_mm256_cmp_pd(sub(largest, middle), sub(middle, smallest), _CMP_GE_OQ), largest, smallest);
+			__m256d r0[3] = { sub(a00, first), a01, a02 };
+			__m256d r1[3] = { a01, sub(a11, first), a12 };
+			__m256d r2[3] = { a02, a12, sub(a22, first) };
+			__m256d v0[3], candidate[3];
+			cross3(r0, r1, v0);
+			__m256d n0 = dot3(v0, v0);
+			for (size_t k = 0; k < 2; k++) {
+				if (k == 0) cross3(r0, r2, candidate);
+				else cross3(r1, r2, candidate);
+				__m256d nc = dot3(candidate, candidate);
+				__m256d better = _mm256_cmp_pd(nc, n0, _CMP_GT_OQ);
+				for (size_t d = 0; d < 3; d++)
+					v0[d] = select(better, candidate[d], v0[d]);
+				n0 = select(better, nc, n0);
+			}
+			__m256d found = _mm256_cmp_pd(n0, zero, _CMP_GT_OQ);
+			__m256d norm0 = _mm256_sqrt_pd(select(found, n0, one));
+			v0[0] = select(found, _mm256_div_pd(v0[0], norm0), one);
+			v0[1] = select(found, _mm256_div_pd(v0[1], norm0), zero);
+			v0[2] = select(found, _mm256_div_pd(v0[2], norm0), zero);
+
+			// orthonormal basis u, w of the plane orthogonal to v0
+			__m256d x = abs(v0[0]), y = abs(v0[1]), z = abs(v0[2]);
+			__m256d use_x = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LE_OQ), _mm256_cmp_pd(x, z, _CMP_LE_OQ));
+			__m256d use_y = _mm256_cmp_pd(y, z, _CMP_LE_OQ);
+			__m256d u[3] = {
+				select(use_x, zero, select(use_y, sub(zero, v0[2]), v0[1])),
+				select(use_x, v0[2], select(use_y, zero, sub(zero, v0[0]))),
+				select(use_x, sub(zero, v0[1]), select(use_y, v0[0], zero)) };
+			__m256d length = _mm256_sqrt_pd(dot3(u, u));
+			for (size_t d = 0; d < 3; d++)
+				u[d] = _mm256_div_pd(u[d], length);
+			__m256d w[3];
+			cross3(v0, u, w);
+
+			// A restricted to the plane, diagonalized by one Jacobi rotation
+			__m256d au[3], aw[3];
+			apply(a, u, au);
+			apply(a, w, aw);
+			__m256d m00 = dot3(u, au), m01 = dot3(w, au), m11 = dot3(w, aw);
+			__m256d rotate = _mm256_cmp_pd(m01, zero, _CMP_NEQ_UQ);
+			__m256d tau  = _mm256_div_pd(sub(m11, m00), mul(two, select(rotate, m01, one)));
+			__m256d sign = select(_mm256_cmp_pd(tau, zero, _CMP_GE_OQ), one, _mm256_set1_pd(-1.0));
+			__m256d t  = select(rotate, _mm256_div_pd(sign, add(abs(tau), _mm256_sqrt_pd(add(one, mul(tau, tau))))), zero);
+			__m256d cs = _mm256_div_pd(one, _mm256_sqrt_pd(add(one, mul(t, t)))), sn = mul(t, cs);
+
+			__m256d values[3] = { first, sub(m00, mul(t, m01)), add(m11, mul(t, m01)) };
+			__m256d vectors[3][3];
+			for (size_t d = 0; d < 3; d++) {
+				vectors[0][d] = v0[d];
+				vectors[1][d] = sub(mul(cs, u[d]), mul(sn, w[d]));
+				vectors[2][d] = add(mul(sn, u[d]), mul(cs, w[d]));
+			}
+
+			// sorting network for three
+			order(values, vectors, 0, 1);
+			order(values, vectors, 1, 2);
+			order(values, vectors, 0, 1);
+
+			// isotropic lanes get q and the unit vectors
+			alignas(32) double value_lanes[3][4], vector_lanes[3][3][4];
+			for (size_t i = 0; i < 3; i++) {
+				_mm256_store_pd(value_lanes[i], mul(select(anisotropic, values[i], q), scale));
+				for (size_t d = 0; d < 3; d++)
+					_mm256_store_pd(vector_lanes[i][d], select(anisotropic, vectors[i][d], i == d ? one : zero));
+			}
+			for (size_t l = 0; l < n; l++) {
+				for (size_t i = 0; i < 3; i++) {
+					out[l].values[i]  = value_lanes[i][l];
+					out[l].vectors[i] = Vector3(vector_lanes[i][0][l], vector_lanes[i][1][l], vector_lanes[i][2][l]);
+				}
+			}
+		}
+
+		#undef PLUGIN1_AVX2
+	}
+#endif
+
+	// solves `count` matrices, four at a time on AVX2 (checked at runtime)
+	inline void symmetric_eigen_batch(const SymmetricMatrix3* matrices, size_t count, SymmetricEigen* out) {
+#ifdef PLUGIN1_EIGEN_AVX2
+		if (__builtin_cpu_supports("avx2")) {
+			for (size_t first = 0; first < count; first += 4)
+				detail::symmetric_eigen_avx2(matrices + first, std::min<size_t>(4, count - first), out + first);
+			return;
+		}
+#endif
+		for (size_t i = 0; i < count; i++)
+			out[i] = symmetric_eigen(matrices[i]);
+	}
+}
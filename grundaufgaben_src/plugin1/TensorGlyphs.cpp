@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fantom/algorithm.hpp>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/domains/Grid.hpp>
+#include <fantom/datastructures/interfaces/Field.hpp>
+#include <fantom/graphics.hpp>
+#include <fantom/math.hpp>
+#include <fantom/register.hpp>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "ChunkedExecution.hpp"
+#include "PackedTensors.hpp"
+#include "SymmetricEigen.hpp"
+
+using namespace fantom;
+using namespace fantom::graphics;
+using plugin1::Progress;
+using plugin1::SymmetricEigen;
+
+namespace
+{
+	/**
+	 * Superquadric tensor glyphs (Kindlmann) at the cell centers of a tensor
+	 * field. All glyphs are one primitive drawn with a single call: every
+	 * glyph is a camera facing billboard whose record (center, eigen frame as
+	 * a quaternion, eigenvalues, shape and colour, 36 bytes) is fetched from
+	 * textures by the vertex shader, and the fragment shader ray casts the
+	 * superquadric like the sphere impostor of
+	 * custom-depth-peeling-frag.glsl. Stride and Max Glyphs thin out the
+	 * cells for large fields.
+	 */
+	class TensorGlyphAlgorithm : public VisAlgorithm {
+		public:
+		struct Options : public VisAlgorithm::Options
+		{
+			Options( fantom::Options::Control& control )
+				: VisAlgorithm::Options( control )
+			{
+				add< Field< 3, Matrix3 > >( "Field", "A 3D Tensor field", definedOn< Grid< 3 > >( Grid< 3 >::Cells ) );
+				add< size_t >( "Stride", "Draw a glyph for every n-th cell", 1 );
+				add< size_t >( "Max Glyphs", "Raise the stride until at most this many glyphs are drawn", 1000000 );
+				add< double >( "Scale", "Size of the glyph with the largest eigenvalue", 1.0 );
+				add< double >( "Sharpness", "Edge sharpness of the superquadrics, 0 draws ellipsoids", 3.0 );
+				add< bool >( "Direction Colors", "Color glyphs by the direction of the major eigenvector", true );
+				add< Color >( "Color", "color of the glyphs", Color(0.8, 0.8, 0.8) );
+				add< bool >( "Parallel", "Build the glyphs on all cores", true );
+			}
+		};
+
+		struct VisOutputs : public VisAlgorithm::VisOutputs
+		{
+			VisOutputs( fantom::VisOutputs::Control& control )
+				: VisAlgorithm::VisOutputs( control )
+			{
+				addGraphics( "Glyphs" );
+			}
+		};
+
+		TensorGlyphAlgorithm( InitData& data )
+			: VisAlgorithm( data )
+		{
+		}
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			setGraphics( "Glyphs", nullptr );
+			auto function = options.get< Function< Matrix3 > >( "Field" );
+			if (!function) return;
+			auto grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain());
+			if (!grid) return;
+
+			const size_t cell_num = function->makeDiscreteEvaluator()->numValues();
+			size_t stride		  = std::max<size_t>(1, options.get<size_t>("Stride"));
+			size_t max_glyphs	  = std::max<size_t>(1, std::min(options.get<size_t>("Max Glyphs"), row * max_rows));
+			stride = std::max(stride, (cell_num + max_glyphs - 1) / max_glyphs);
+
+			// the selected cells packed into 6 floats each
+			bool parallel = options.get<bool>("Parallel");
+			plugin1::SymmetricTensorArray tensors;
+			if (!plugin1::pack_tensors(*function, stride, parallel, abortFlag, tensors)) return;
+			const size_t count = tensors.size();
+			if (count == 0) return;
+
+			sharpness = std::max(0.0, options.get<double>("Sharpness"));
+			direction_colors = options.get<bool>("Direction Colors");
+			color = options.get<Color>("Color");
+
+			// one record per glyph in three textures with `row` glyphs per
+			// texel row: center and sharpness alpha as floats, rotation,
+			// scale and beta as half floats (two texels) and 8 bit colour.
+			// the vertex shader fetches the record of gl_VertexID / 4 and
+			// picks the billboard corner from gl_VertexID % 4
+			const size_t rows = (count + row - 1) / row;
+			std::vector<float> centers(4 * row * rows, 0.0f);
+			std::vector<float> frames(8 * row * rows, 0.0f);
+			std::vector<uint8_t> colors(4 * row * rows, 0);
+
+			// decompose blocks of the packed cells on all cores, the glyphs are
+			// normalized by the largest eigenvalue magnitude afterwards
+			const size_t chunk_size = 4096;
+			std::vector<double> chunk_max((count + chunk_size - 1) / chunk_size, 0.0);
+			const auto& points = grid->points();
+			Progress progress("building tensor glyphs", count);
+			bool finished = plugin1::parallel_for_chunks(count, chunk_size, abortFlag, progress, parallel,
+				[]() { return 0; },
+				[&](int, size_t chunk, size_t begin, size_t end) {
+					plugin1::for_each_eigen_block(tensors, begin, end, [&](size_t first, size_t n, const SymmetricEigen* eigen) {
+						for (size_t i = 0; i < n; i++) {
+							size_t g = first + i;
+							Cell cell = grid->cell(g * stride);
+							Point3 center(0, 0, 0);
+							for (size_t k = 0; k < cell.numVertices(); k++)
+								center += points[cell.index(k)];
+							center = center / double(cell.numVertices());
+
+							Glyph glyph = make_glyph(eigen[i]);
+							float center_record[4] = { float(center[0]), float(center[1]), float(center[2]), glyph.shape[0] };
+							float frame_record[8]  = { glyph.rotation[0], glyph.rotation[1], glyph.rotation[2], glyph.rotation[3],
+													   glyph.scale[0], glyph.scale[1], glyph.scale[2], glyph.shape[1] };
+							std::copy(center_record, center_record + 4, &centers[4 * g]);
+							std::copy(frame_record, frame_record + 8, &frames[8 * g]);
+							std::copy(glyph.color, glyph.color + 4, &colors[4 * g]);
+							chunk_max[chunk] = std::max(chunk_max[chunk], glyph.magnitude);
+						}
+					});
+				});
+			if (!finished) return;
+
+			double magnitude = *std::max_element(chunk_max.begin(), chunk_max.end());
+			if (!(magnitude > 0)) return;
+			float factor = static_cast<float>(options.get<double>("Scale") / magnitude);
+			#pragma omp parallel for if(parallel)
+			for (size_t g = 0; g < count; g++)
+				for (size_t d = 4; d < 7; d++)
+					frames[8 * g + d] *= factor;
+
+			std::vector<unsigned int> indices(6 * count);
+			for (size_t g = 0; g < count; g++) {
+				unsigned int base = 4 * g;
+				unsigned int quad[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+				std::copy(quad, quad + 6, &indices[6 * g]);
+			}
+
+			// bounding sphere of all centers plus the largest glyph
+			PointF<3> low(centers[0], centers[1], centers[2]), high = low;
+			for (size_t g = 0; g < count; g++)
+				for (size_t d = 0; d < 3; d++) {
+					low[d]	= std::min(low[d], centers[4 * g + d]);
+					high[d] = std::max(high[d], centers[4 * g + d]);
+				}
+			float radius = 0.5f * norm(high - low) + std::sqrt(3.0f) * factor * magnitude;
+
+			auto const& system = GraphicsSystem::instance();
+			auto center_texture = system.makeTexture( Size2D{ row, rows }, ColorChannel::RGBA, Precision::FLOAT32 );
+			center_texture->rangeData( { 0, 0 }, Size2D{ row, rows }, centers );
+			auto frame_texture = system.makeTexture( Size2D{ 2 * row, rows }, ColorChannel::RGBA, Precision::FLOAT16 );
+			frame_texture->rangeData( { 0, 0 }, Size2D{ 2 * row, rows }, frames );
+			auto color_texture = system.makeTexture( Size2D{ row, rows }, ColorChannel::RGBA, Precision::UINT8 );
+			color_texture->rangeData( { 0, 0 }, Size2D{ row, rows }, colors );
+			std::cout << "tensor glyphs: " << count << " glyphs, " << count * (16 + 16 + 4 + 6 * sizeof(unsigned int)) / 1024 << " KiB" << std::endl;
+
+			auto resPath = PluginRegistrationService::getInstance().getResourcePath( "general/Tutorial" );
+			auto config = PrimitiveConfig{ RenderPrimitives::TRIANGLES }
+				.texture( "glyph_centers", center_texture )
+				.texture( "glyph_frames", frame_texture )
+				.texture( "glyph_colors", color_texture )
+				.indexBuffer( system.makeIndexBuffer( indices ) )
+				.boundingSphere( BoundingSphere( 0.5f * (low + high), radius ) )
+				.renderBin( RenderBin::Opaque );
+			setGraphics( "Glyphs", system.makePrimitive( std::move( config ),
+				system.makeProgramFromFiles( resPath + "tensor-glyph-vert.glsl", resPath + "tensor-glyph-frag.glsl" ) ) );
+		}
+
+		private:
+		// glyphs per texel row of the record textures
+		static const size_t row		 = 4096;
+		static const size_t max_rows = 16384;
+
+		struct Glyph {
+			Tensor<float, 4> rotation;
+			VectorF<3> scale;
+			Tensor<float, 2> shape;
+			uint8_t color[4];
+			double magnitude;
+		};
+
+		// superquadric of one tensor with unnormalized scale. linear tensors
+		// get the major eigenvector as glyph axis, planar ones the minor
+		Glyph make_glyph(const SymmetricEigen& eigen) const {
+			double l[3];
+			for (size_t k = 0; k < 3; k++)
+				l[k] = std::abs(eigen.values[k]);
+			size_t major = std::max_element(l, l + 3) - l;
+			size_t minor = std::min_element(l, l + 3) - l;
+			if (major == minor) minor = (major + 1) % 3;
+			size_t median = 3 - major - minor;
+
+			// westin measures of the magnitudes
+			double sum = l[0] + l[1] + l[2];
+			double cl  = sum > 0 ? (l[major] - l[median]) / sum : 0.0;
+			double cp  = sum > 0 ? 2 * (l[median] - l[minor]) / sum : 0.0;
+
+			// glyph axes x, y, z
+			size_t axes[3];
+			double alpha, beta;
+			if (cl >= cp) {
+				axes[0] = median, axes[1] = minor, axes[2] = major;
+				alpha	= std::pow(1 - cp, sharpness);
+				beta	= std::pow(1 - cl, sharpness);
+			} else {
+				axes[0] = major, axes[1] = median, axes[2] = minor;
+				alpha	= std::pow(1 - cl, sharpness);
+				beta	= std::pow(1 - cp, sharpness);
+			}
+
+			// right handed frame, z follows from x and y
+			Vector3 x = eigen.vectors[axes[0]];
+			Vector3 y = eigen.vectors[axes[1]];
+			Vector3 z = cross(x, y);
+
+			Glyph glyph;
+			glyph.rotation	= quaternion(x, y, z);
+			glyph.magnitude = l[major];
+			for (size_t d = 0; d < 3; d++)
+				glyph.scale[d] = static_cast<float>(std::max(l[axes[d]], 0.05 * l[major]));
+			glyph.shape = Tensor<float, 2>(std::max(alpha, 0.1), std::max(beta, 0.1));
+
+			double rgba[4] = { color.r(), color.g(), color.b(), color.a() };
+			if (direction_colors) {
+				const Vector3& e = eigen.vectors[major];
+				rgba[0] = std::abs(e[0]), rgba[1] = std::abs(e[1]), rgba[2] = std::abs(e[2]), rgba[3] = 1.0;
+			}
+			for (size_t k = 0; k < 4; k++)
+				glyph.color[k] = static_cast<uint8_t>(std::lround(255 * std::min(1.0, std::max(0.0, rgba[k]))));
+			return glyph;
+		}
+
+		// unit quaternion (x, y, z, w) of the rotation with columns x, y, z
+		static Tensor<float, 4> quaternion(const Vector3& x, const Vector3& y, const Vector3& z) {
+			double trace = x[0] + y[1] + z[2];
+			double q[4];
+			if (trace > 0) {
+				double s = 0.5 / std::sqrt(trace + 1);
+				q[3] = 0.25 / s;
+				q[0] = (y[2] - z[1]) * s;
+				q[1] = (z[0] - x[2]) * s;
+				q[2] = (x[1] - y[0]) * s;
+			} else if (x[0] > y[1] && x[0] > z[2]) {
+				double s = 2 * std::sqrt(1 + x[0] - y[1] - z[2]);
+				q[3] = (y[2] - z[1]) / s;
+				q[0] = 0.25 * s;
+				q[1] = (y[0] + x[1]) / s;
+				q[2] = (z[0] + x[2]) / s;
+			} else if (y[1] > z[2]) {
+				double s = 2 * std::sqrt(1 + y[1] - x[0] - z[2]);
+				q[3] = (z[0] - x[2]) / s;
+				q[0] = (y[0] + x[1]) / s;
+				q[1] = 0.25 * s;
+				q[2] = (z[1] + y[2]) / s;
+			} else {
+				double s = 2 * std::sqrt(1 + z[2] - x[0] - y[1]);
+				q[3] = (x[1] - y[0]) / s;
+				q[0] = (z[0] + x[2]) / s;
+				q[1] = (z[1] + y[2]) / s;
+				q[2] = 0.25 * s;
+			}
+			return Tensor<float, 4>(q[0], q[1], q[2], q[3]);
+		}
+
+		double sharpness = 3.0;
+		bool direction_colors = true;
+		Color color;
+	};
+
+	AlgorithmRegister< TensorGlyphAlgorithm > dummy( "Hauptaufgabe/TensorGlyphs", "Superquadric tensor glyphs" );
+}
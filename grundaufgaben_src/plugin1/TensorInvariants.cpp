@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fantom/algorithm.hpp>
+#include <fantom/datastructures/DomainFactory.hpp>
+#include <fantom/math.hpp>
+#include <fantom/register.hpp>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/domains/Grid.hpp>
+#include <fantom/datastructures/interfaces/Field.hpp>
+#include <memory>
+#include <vector>
+
+#include "ChunkedExecution.hpp"
+#include "PackedTensors.hpp"
+#include "SymmetricEigen.hpp"
+
+using namespace fantom;
+using plugin1::Progress;
+using plugin1::SymmetricEigen;
+
+namespace
+{
+	/**
+	 * Scalar invariants of a cell defined tensor field: fractional anisotropy,
+	 * trace, tensor mode, the Westin measures and the sorted eigenvalues. All
+	 * of them come from one decomposition per cell, the cells are packed
+	 * into 6 floats first and blocks of them are decomposed with the
+	 * batched solver on all cores.
+	 */
+	class TensorInvariantsAlgorithm : public DataAlgorithm {
+		public:
+		struct Options : public DataAlgorithm::Options
+		{
+			Options( fantom::Options::Control& control )
+				: DataAlgorithm::Options( control )
+			{
+				add< Field< 3, Matrix3 > >( "Field", "A 3D Tensor field", definedOn< Grid< 3 > >( Grid< 3 >::Cells ) );
+				add< bool >( "Parallel", "Compute on all cores", true );
+			}
+		};
+
+		struct DataOutputs : public DataAlgorithm::DataOutputs
+		{
+			DataOutputs( fantom::DataOutputs::Control& control )
+				: DataAlgorithm::DataOutputs( control )
+			{
+				for (size_t i = 0; i < INVARIANT_NUM; i++)
+					add< Function< Scalar > >( names[i] );
+			}
+		};
+
+		TensorInvariantsAlgorithm( InitData& data )
+			: DataAlgorithm( data )
+		{
+		}
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			auto function = options.get< Function< Matrix3 > >( "Field" );
+			if (!function) return;
+			auto grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain());
+			if (!grid) return;
+
+			// pack first, the sweep then streams 6 floats per cell
+			bool parallel = options.get<bool>("Parallel");
+			plugin1::SymmetricTensorArray tensors;
+			if (!plugin1::pack_tensors(*function, 1, parallel, abortFlag, tensors)) return;
+			const size_t count = tensors.size();
+			std::vector<std::vector<Scalar>> results(INVARIANT_NUM, std::vector<Scalar>(count));
+
+			Progress progress("computing tensor invariants", count);
+			bool finished = plugin1::parallel_for_chunks(count, 4096, abortFlag, progress, parallel,
+				[]() { return 0; },
+				[&](int, size_t, size_t begin, size_t end) {
+					plugin1::for_each_eigen_block(tensors, begin, end, [&](size_t first, size_t n, const SymmetricEigen* eigen) {
+						for (size_t i = 0; i < n; i++) {
+							double invariants[INVARIANT_NUM];
+							compute(eigen[i].values, invariants);
+							for (size_t k = 0; k < INVARIANT_NUM; k++)
+								results[k][first + i] = Scalar(invariants[k]);
+						}
+					});
+				});
+			if (!finished) return;
+
+			for (size_t k = 0; k < INVARIANT_NUM; k++)
+				setResult( names[k], DomainFactory::makeFunction( grid, Grid< 3 >::Cells, std::move(results[k]) ) );
+		}
+
+		private:
+		enum Invariant { FA, TRACE, MODE, LINEAR, PLANAR, SPHERICAL, MAJOR, MEDIAN, MINOR, INVARIANT_NUM };
+		static const char* const names[INVARIANT_NUM];
+
+		// `values` in ascending order
+		static void compute(const double values[3], double out[INVARIANT_NUM]) {
+			double trace = values[0] + values[1] + values[2];
+			double mean	 = trace / 3;
+
+			// mode of the deviatoric part, -1 for planar and 1 for linear shapes
+			double d0 = values[0] - mean, d1 = values[1] - mean, d2 = values[2] - mean;
+			double deviation = std::sqrt(d0 * d0 + d1 * d1 + d2 * d2);
+			double mode		 = deviation > 0 ? 3 * std::sqrt(6.0) * d0 * d1 * d2 / (deviation * deviation * deviation) : 0.0;
+
+			// westin measures normalized by the trace, they add up to one
+			double linear = 0, planar = 0, spherical = 0;
+			if (trace != 0) {
+				linear	  = (values[2] - values[1]) / trace;
+				planar	  = 2 * (values[1] - values[0]) / trace;
+				spherical = 3 * values[0] / trace;
+			}
+
+			out[FA]		   = plugin1::fractional_anisotropy(values);
+			out[TRACE]	   = trace;
+			out[MODE]	   = std::max(-1.0, std::min(1.0, mode));
+			out[LINEAR]	   = linear;
+			out[PLANAR]	   = planar;
+			out[SPHERICAL] = spherical;
+			out[MAJOR]	   = values[2];
+			out[MEDIAN]	   = values[1];
+			out[MINOR]	   = values[0];
+		}
+	};
+
+	const char* const TensorInvariantsAlgorithm::names[TensorInvariantsAlgorithm::INVARIANT_NUM] = {
+		"Fractional Anisotropy", "Trace", "Mode", "Linear", "Planar", "Spherical",
+		"Major Eigenvalue", "Median Eigenvalue", "Minor Eigenvalue"
+	};
+
+	AlgorithmRegister< TensorInvariantsAlgorithm > dummy( "Hauptaufgabe/TensorInvariants", "Scalar invariants of a tensor field" );
+}
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fantom/algorithm.hpp>
+#include <fantom/dataset.hpp>
+#include <fantom/datastructures/domains/Grid.hpp>
+#include <fantom/datastructures/interfaces/Field.hpp>
+#include <fantom/graphics.hpp>
+#include <fantom/math.hpp>
+#include <fantom/register.hpp>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "CellEigenField.hpp"
+#include "ChunkedExecution.hpp"
+#include "SymmetricEigen.hpp"
+
+using namespace fantom;
+using namespace fantom::graphics;
+using plugin1::Progress;
+using plugin1::SymmetricEigen;
+using plugin1::TensorSampler;
+
+namespace
+{
+	/**
+	 * Hyperstreamline tubes: sweeps an ellipse along every line of a
+	 * LineSet (e.g. the output of TensorAlgorithm) whose axes are the two
+	 * eigenvectors across the line, scaled by their eigenvalues. All tubes
+	 * go into one preallocated vertex and index buffer that is filled on all
+	 * cores, every line knows its range from a prefix sum over the vertex
+	 * counts. The cross section resolution drops automatically when the
+	 * tubes would exceed Max Triangles, below triangular cross sections the
+	 * lines are thinned out. Cell data on uniform grids is sampled through
+	 * CellEigenField.
+	 */
+	class TensorTubeAlgorithm : public VisAlgorithm {
+		public:
+		struct Options : public VisAlgorithm::Options
+		{
+			Options( fantom::Options::Control& control )
+				: VisAlgorithm::Options( control )
+			{
+				add< Field< 3, Matrix3 > >( "Field", "A 3D Tensor field", definedOn< Grid< 3 > >( Grid< 3 >::Cells ) );
+				add< LineSet< 3 > >( "Lines", "Hyperstreamlines of the field" );
+				add< double >( "Radius", "Tube radius for the largest transverse eigenvalue", 0.1 );
+				add< size_t >( "Resolution", "Vertices per cross section", 12 );
+				add< size_t >( "Max Triangles", "Lower the resolution until the tubes fit into this many triangles", 20000000 );
+				add< Color >( "Color", "color of the tubes", Color(0.8, 0.5, 0.2) );
+				add< bool >( "Parallel", "Build the tubes on all cores", true );
+				add< bool >( "Eigen Table", "Store the eigenvectors of every cell so sampling only looks them up. Off halves the memory and decomposes the packed tensor per vertex", true );
+			}
+		};
+
+		struct VisOutputs : public VisAlgorithm::VisOutputs
+		{
+			VisOutputs( fantom::VisOutputs::Control& control )
+				: VisAlgorithm::VisOutputs( control )
+			{
+				addGraphics( "Tubes" );
+			}
+		};
+
+		TensorTubeAlgorithm( InitData& data )
+			: VisAlgorithm( data )
+		{
+		}
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			setGraphics( "Tubes", nullptr );
+			auto field = options.get< Field< 3, Matrix3 > >( "Field" );
+			auto lines = options.get< LineSet< 3 > >( "Lines" );
+			if (!field || !lines) return;
+
+			// level of detail: fewer vertices per cross section for many
+			// segments. if even triangles as cross sections do not fit, only
+			// every n-th vertex of the lines is used
+			const auto& line_points = lines->points();
+			size_t all_segments = 0;
+			for (size_t l = 0; l < lines->numLines(); l++)
+				all_segments += std::max<size_t>(1, lines->getLine(l).size()) - 1;
+			size_t max_triangles = std::max<size_t>(1, options.get<size_t>("Max Triangles"));
+			size_t vertex_stride = std::max<size_t>(1, (6 * all_segments + max_triangles - 1) / max_triangles);
+
+			// flatten the lines, offsets[l] is the first vertex of line l
+			std::vector<Point3> points;
+			std::vector<size_t> offsets{ 0 };
+			for (size_t l = 0; l < lines->numLines(); l++) {
+				const auto& line = lines->getLine(l);
+				if (line.size() < 2) continue;
+				for (size_t i = 0; i < line.size(); i += vertex_stride)
+					points.push_back(line_points[line[i]]);
+				if ((line.size() - 1) % vertex_stride != 0)
+					points.push_back(line_points[line.back()]);
+				offsets.push_back(points.size());
+			}
+			const size_t line_num = offsets.size() - 1;
+			const size_t segments = points.size() - line_num;
+			if (line_num == 0) return;
+			if (6 * segments > max_triangles) {
+				std::cout << "tensor tubes: at least " << 6 * segments << " triangles needed, raise Max Triangles" << std::endl;
+				return;
+			}
+			if (vertex_stride > 1)
+				std::cout << "tensor tubes: keeping 1 of " << vertex_stride << " line vertices to stay within Max Triangles" << std::endl;
+
+			size_t resolution = std::max<size_t>(3, options.get<size_t>("Resolution"));
+			resolution = std::max<size_t>(3, std::min(resolution, max_triangles / (2 * segments)));
+			if (points.size() * resolution > UINT32_MAX) {
+				std::cout << "tensor tubes: too many vertices" << std::endl;
+				return;
+			}
+
+			// cell data on uniform grids is located arithmetically
+			update_cells(field, options.get< Function< Matrix3 > >( "Field" ), options.get<bool>("Eigen Table"), abortFlag);
+			if (abortFlag) return;
+
+			// cross section axes and eigenvalues at every vertex
+			bool parallel = options.get<bool>("Parallel");
+			std::vector<Frame> frames(points.size());
+			const size_t chunk_size = 64;
+			std::vector<double> chunk_max((line_num + chunk_size - 1) / chunk_size, 0.0);
+			Progress frame_progress("sampling tube cross sections", line_num);
+			bool finished = plugin1::parallel_for_chunks(line_num, chunk_size, abortFlag, frame_progress, parallel,
+				[&]() { return TensorSampler(cells.get(), field->makeEvaluator()); },
+				[&](TensorSampler& sampler, size_t chunk, size_t begin, size_t end) {
+					for (size_t l = begin; l < end; l++)
+						chunk_max[chunk] = std::max(chunk_max[chunk], line_frames(sampler, points, offsets[l], offsets[l + 1], frames));
+				});
+			if (!finished) return;
+			double magnitude = *std::max_element(chunk_max.begin(), chunk_max.end());
+			double scale	 = magnitude > 0 ? options.get<double>("Radius") / magnitude : 0.0;
+
+			// every line writes its own range of the shared buffers
+			std::vector<PointF<3>> vertices(points.size() * resolution);
+			std::vector<VectorF<3>> normals(points.size() * resolution);
+			std::vector<unsigned int> indices(6 * segments * resolution);
+			Progress tube_progress("building tubes", line_num);
+			finished = plugin1::parallel_for_chunks(line_num, chunk_size, abortFlag, tube_progress, parallel,
+				[]() { return 0; },
+				[&](int, size_t, size_t begin, size_t end) {
+					for (size_t l = begin; l < end; l++)
+						build_tube(points, frames, offsets[l], offsets[l + 1], l, resolution, scale, vertices, normals, indices);
+				});
+			if (!finished) return;
+
+			auto const& system = GraphicsSystem::instance();
+			std::string resourcePath = PluginRegistrationService::getInstance().getResourcePath( "utils/Graphics" );
+			setGraphics( "Tubes", system.makePrimitive(
+				PrimitiveConfig{ RenderPrimitives::TRIANGLES }
+					.vertexBuffer( "position", system.makeBuffer( vertices ) )
+					.vertexBuffer( "normal", system.makeBuffer( normals ) )
+					.indexBuffer( system.makeIndexBuffer( indices ) )
+					.uniform( "color", options.get<Color>("Color") )
+					.boundingSphere( graphics::computeBoundingSphere( vertices ) ),
+				system.makeProgramFromFiles( resourcePath + "shader/surface/phong/singleColor/vertex.glsl",
+				                             resourcePath + "shader/surface/phong/singleColor/fragment.glsl" ) ) );
+		}
+
+		private:
+		std::unique_ptr<plugin1::CellEigenField> cells;
+		std::weak_ptr<const Field<3, Matrix3>> cells_field;
+		bool cells_eigen_table = true;
+
+		// rebuilds the cell field when the field changed, leaves it empty
+		// (evaluate and decompose per vertex) if the field is not defined on
+		// the cells of a uniform grid
+		void update_cells(const std::shared_ptr<const Field<3, Matrix3>>& field, const std::shared_ptr<const Function<Matrix3>>& function,
+			bool eigen_table, const volatile bool& abortFlag) {
+			if (!cells_field.expired() && cells_field.lock() == field && cells_eigen_table == eigen_table) return;
+			cells.reset();
+			cells_field.reset();
+			if (!function) return;
+			if (auto grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain()))
+				cells = plugin1::CellEigenField::make(*grid, *function, *field, eigen_table, abortFlag);
+			if (abortFlag) return;
+			cells_field		  = field;
+			cells_eigen_table = eigen_table;
+		}
+
+		// unit axes of the ellipse and its radii
+		struct Frame {
+			Vector3 a = Vector3(0, 0, 0);
+			Vector3 b = Vector3(0, 0, 0);
+			double ra = 0, rb = 0;
+		};
+
+		// frames of the vertices [begin, end), returns the largest radius. the
+		// eigenvector closest to the tangent runs along the line, the axes are
+		// made orthogonal to the tangent and keep their sign from vertex to
+		// vertex so the tube does not twist
+		static double line_frames(TensorSampler& sampler, const std::vector<Point3>& points, size_t begin, size_t end, std::vector<Frame>& frames) {
+			double largest = 0;
+			Vector3 previous_a(0, 0, 0);
+			for (size_t i = begin; i < end; i++) {
+				Vector3 tangent = points[std::min(i + 1, end - 1)] - points[i > begin ? i - 1 : i];
+				double length	= fantom::norm(tangent);
+				if (length > 0) tangent = tangent / length;
+
+				Frame frame = i > begin ? frames[i - 1] : Frame();
+				SymmetricEigen eigen;
+				if (sampler.sample(points[i], eigen) && length > 0) {
+					size_t along = 0;
+					for (size_t k = 1; k < 3; k++)
+						if (std::abs(plugin1::inner(eigen.vectors[k], tangent)) > std::abs(plugin1::inner(eigen.vectors[along], tangent)))
+							along = k;
+					size_t first = (along + 1) % 3, second = (along + 2) % 3;
+
+					Vector3 a = eigen.vectors[first] - tangent * plugin1::inner(eigen.vectors[first], tangent);
+					if (fantom::norm(a) > 1e-9) {
+						a = a / fantom::norm(a);
+						if (plugin1::inner(a, previous_a) < 0) a = a * -1.0;
+						frame.a	 = a;
+						frame.b	 = cross(tangent, a);
+						frame.ra = std::abs(eigen.values[first]);
+						frame.rb = std::abs(eigen.values[second]);
+					}
+				}
+				// keep flat cross sections visible
+				double floor = 0.1 * std::max(frame.ra, frame.rb);
+				frame.ra = std::max(frame.ra, floor);
+				frame.rb = std::max(frame.rb, floor);
+				largest	 = std::max({ largest, frame.ra, frame.rb });
+				previous_a = frame.a;
+				frames[i]  = frame;
+			}
+			return largest;
+		}
+
+		// writes the vertices of line `l` (points [begin, end)) and the
+		// triangles between its cross sections
+		static void build_tube(const std::vector<Point3>& points, const std::vector<Frame>& frames, size_t begin, size_t end, size_t l,
+			size_t resolution, double scale, std::vector<PointF<3>>& vertices, std::vector<VectorF<3>>& normals, std::vector<unsigned int>& indices) {
+			for (size_t i = begin; i < end; i++) {
+				const Frame& frame = frames[i];
+				for (size_t k = 0; k < resolution; k++) {
+					double angle = 2 * M_PI * k / resolution;
+					double c = std::cos(angle), s = std::sin(angle);
+					Point3 p  = points[i] + (frame.a * (frame.ra * c) + frame.b * (frame.rb * s)) * scale;
+					Vector3 n = frame.a * (frame.rb * c) + frame.b * (frame.ra * s);
+					double length = fantom::norm(n);
+					if (length > 0) n = n / length;
+					vertices[i * resolution + k] = PointF<3>(p[0], p[1], p[2]);
+					normals[i * resolution + k]	 = VectorF<3>(n[0], n[1], n[2]);
+				}
+			}
+
+			// segments before this line: all vertices before it minus one per line
+			unsigned int* out = &indices[6 * (begin - l) * resolution];
+			for (size_t i = begin; i + 1 < end; i++)
+				for (size_t k = 0; k < resolution; k++) {
+					unsigned int a = i * resolution + k;
+					unsigned int b = i * resolution + (k + 1) % resolution;
+					unsigned int c = a + resolution;
+					unsigned int d = b + resolution;
+					unsigned int quad[6] = { a, b, d, a, d, c };
+					out = std::copy(quad, quad + 6, out);
+				}
+		}
+	};
+
+	AlgorithmRegister< TensorTubeAlgorithm > dummy( "Hauptaufgabe/TensorTubes", "Hyperstreamline tubes of a tensor field" );
+}
@@ -0,0 +1,101 @@
+#version 330 core
+
+uniform mat4 view;
+uniform mat4 proj;
+
+flat in vec3 glyph_center;
+flat in vec4 glyph_rotation;
+flat in vec3 glyph_scale;
+flat in vec2 glyph_shape;
+flat in vec4 glyph_color;
+
+noperspective in vec3 p1;
+noperspective in vec3 p2;
+
+out vec4 out_color;
+
+
+float depth( vec3 point, mat4 proj )
+{
+    float far = gl_DepthRange.far;
+    float near = gl_DepthRange.near;
+    vec4 p = proj * vec4( point, 1.0 );
+    return ( ( gl_DepthRange.diff * p.z / p.w ) + near + far ) / 2.0;
+}
+
+// Rotate v by the unit quaternion q (xyz vector part, w scalar part)
+vec3 rotate( vec4 q, vec3 v )
+{
+    return v + 2.0 * cross( q.xyz, cross( q.xyz, v ) + q.w * v );
+}
+
+// Implicit superquadric in glyph space, negative inside
+float superquadric( vec3 p )
+{
+    float alpha = glyph_shape.x;
+    float beta = glyph_shape.y;
+    vec3 a = max( abs( p ), vec3( 1e-6 ) );
+    float xy = pow( a.x, 2.0 / alpha ) + pow( a.y, 2.0 / alpha );
+    return pow( xy, alpha / beta ) + pow( a.z, 2.0 / beta ) - 1.0;
+}
+
+void main()
+{
+    // View ray in glyph space, where the glyph fills the box [-1, 1]^3
+    vec4 inverse = vec4( -glyph_rotation.xyz, glyph_rotation.w );
+    vec3 origin = rotate( inverse, p1 - glyph_center ) / glyph_scale;
+    vec3 direction = rotate( inverse, p2 - p1 ) / glyph_scale;
+
+    // Clip the ray against the box
+    vec3 t0 = ( -1.0 - origin ) / direction;
+    vec3 t1 = ( 1.0 - origin ) / direction;
+    vec3 tmin = min( t0, t1 );
+    vec3 tmax = max( t0, t1 );
+    float enter = max( max( tmin.x, tmin.y ), max( tmin.z, 0.0 ) );
+    float leave = min( min( tmax.x, tmax.y ), min( tmax.z, 1.0 ) );
+    if( enter >= leave )
+    {
+        discard;
+    }
+
+    // March to the first sign change, then refine by bisection
+    const int steps = 32;
+    float dt = ( leave - enter ) / float( steps );
+    float t = enter;
+    bool hit = superquadric( origin + t * direction ) < 0.0;
+    for( int i = 0; i < steps && !hit; ++i )
+    {
+        t += dt;
+        hit = superquadric( origin + t * direction ) < 0.0;
+    }
+    if( !hit )
+    {
+        discard;
+    }
+    float low = max( enter, t - dt );
+    float high = t;
+    for( int i = 0; i < 10; ++i )
+    {
+        float mid = 0.5 * ( low + high );
+        if( superquadric( origin + mid * direction ) < 0.0 )
+            high = mid;
+        else
+            low = mid;
+    }
+    vec3 local = origin + high * direction;
+
+    // Normal from the gradient, back to world space
+    const float h = 1e-3;
+    vec3 gradient = vec3(
+      superquadric( local + vec3( h, 0.0, 0.0 ) ) - superquadric( local - vec3( h, 0.0, 0.0 ) ),
+      superquadric( local + vec3( 0.0, h, 0.0 ) ) - superquadric( local - vec3( 0.0, h, 0.0 ) ),
+      superquadric( local + vec3( 0.0, 0.0, h ) ) - superquadric( local - vec3( 0.0, 0.0, h ) ) );
+    vec3 normal = normalize( rotate( glyph_rotation, gradient / glyph_scale ) );
+
+    // Head light
+    vec3 hitp = glyph_center + rotate( glyph_rotation, local * glyph_scale );
+    float diffuse = abs( dot( normal, normalize( p2 - p1 ) ) );
+    out_color = vec4( glyph_color.rgb * ( 0.2 + 0.8 * diffuse ), glyph_color.a );
+
+    gl_FragDepth = depth( hitp, proj * view );
+}
@@ -0,0 +1,58 @@
+#version 330 core
+
+// Glyph records, glyph g is texel g of the center and colour textures and
+// texels 2g, 2g + 1 of the frame texture, 4096 glyphs per row
+uniform sampler2D glyph_centers; // center, alpha
+uniform sampler2D glyph_frames;  // rotation; scale, beta
+uniform sampler2D glyph_colors;
+
+uniform mat4 view;
+uniform mat4 proj;
+uniform mat4 view_inv;
+uniform mat4 proj_inv;
+
+flat out vec3 glyph_center;
+flat out vec4 glyph_rotation;
+flat out vec3 glyph_scale;
+flat out vec2 glyph_shape;
+flat out vec4 glyph_color;
+
+// Near and far point of the view ray through this fragment
+noperspective out vec3 p1;
+noperspective out vec3 p2;
+
+const int row = 4096;
+const vec2 corners[4] = vec2[4]( vec2( -1.0, -1.0 ), vec2( 1.0, -1.0 ), vec2( 1.0, 1.0 ), vec2( -1.0, 1.0 ) );
+
+
+vec3 homog( vec4 v )
+{
+    return v.xyz / v.w;
+}
+
+void main()
+{
+    // Every glyph owns four consecutive vertex ids, one per billboard corner
+    int glyph = gl_VertexID / 4;
+    ivec2 texel = ivec2( glyph % row, glyph / row );
+    vec4 center = texelFetch( glyph_centers, texel, 0 );
+    vec4 rotation = texelFetch( glyph_frames, ivec2( 2 * texel.x, texel.y ), 0 );
+    vec4 scale = texelFetch( glyph_frames, ivec2( 2 * texel.x + 1, texel.y ), 0 );
+
+    glyph_center = center.xyz;
+    glyph_rotation = normalize( rotation );
+    glyph_scale = scale.xyz;
+    glyph_shape = vec2( center.w, scale.w );
+    glyph_color = texelFetch( glyph_colors, texel, 0 );
+
+    // Billboard facing the camera in front of the bounding sphere of the
+    // glyph box, it covers the whole projected sphere
+    float radius = length( glyph_scale );
+    vec3 view_center = ( view * vec4( glyph_center, 1.0 ) ).xyz;
+    vec2 corner = corners[gl_VertexID % 4];
+    gl_Position = proj * vec4( view_center + vec3( corner * radius, radius ), 1.0 );
+
+    vec2 ndc = gl_Position.xy / gl_Position.w;
+    p1 = homog( view_inv * proj_inv * vec4( ndc, -1.0, 1.0 ) );
+    p2 = homog( view_inv * proj_inv * vec4( ndc, 1.0, 1.0 ) );
+}